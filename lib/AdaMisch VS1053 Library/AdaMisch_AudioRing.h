@@ -0,0 +1,168 @@
+/*!
+ * @file AdaMisch_AudioRing.h
+ *
+ * Single producer / single consumer ring between the main loop, which reads
+ * whole sectors from the SD card, and the DREQ interrupt, which hands 32 byte
+ * chunks to the VS1053.
+ *
+ * The ring is organised in chunks of AUDIORING_CHUNKLEN bytes. head and tail
+ * are free running 8 bit chunk counters: only the producer writes head, only
+ * the consumer writes tail. A single byte load or store is atomic on the 8-bit
+ * AVR, so neither side has to disable interrupts.
+ *
+ * The producer always commits a whole sector, so every sector buffer it gets
+ * is sector aligned in RAM. Chunks beyond a short read get length 0 and are
+ * skipped by the consumer.
+ *
+ * No Arduino headers are used here so the ring can be driven from a host build
+ * with a simulated DREQ.
+ */
+
+#ifndef ADAMISCH_AUDIORING_H
+#define ADAMISCH_AUDIORING_H
+
+#include <stdint.h>
+
+#define AUDIORING_CHUNKLEN 32   //!< Bytes per chunk, one DREQ transfer
+#define AUDIORING_SECTORLEN 512 //!< Bytes per producer refill, one SD sector
+#ifndef AUDIORING_SECTORS
+#define AUDIORING_SECTORS 2 //!< Sectors in the ring, 1, 2, 4 or 8
+#endif
+#define AUDIORING_SECTORCHUNKS \
+  (AUDIORING_SECTORLEN / AUDIORING_CHUNKLEN) //!< Chunks per sector
+#define AUDIORING_CHUNKS \
+  (AUDIORING_SECTORS * AUDIORING_SECTORCHUNKS) //!< Chunks in the ring
+
+#if (256 % AUDIORING_CHUNKS) != 0
+#error "AUDIORING_CHUNKS must divide 256 for the 8 bit counters to wrap"
+#endif
+#if AUDIORING_CHUNKS >= 256
+#error "AUDIORING_SECTORS must be 8 or less, with 256 chunks a full ring looks empty"
+#endif
+
+//! compiler barrier, keeps data stores in front of the index store
+#define AUDIORING_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+/*!
+ * @brief Lock-free audio ring between SD reader and DREQ feeder
+ */
+class AudioRing
+{
+public:
+  /*!
+   * @brief Empty the ring. Only allowed while the consumer is not running.
+   */
+  void reset(void)
+  {
+    head = 0;
+    tail = 0;
+  }
+
+  /*!
+   * @brief Number of chunks waiting for the consumer
+   * @return Chunk count
+   */
+  uint8_t fill(void) const { return (uint8_t)(head - tail); }
+
+  /*!
+   * @brief Test if nothing is waiting for the consumer
+   * @return Returns true if the ring is empty
+   */
+  bool empty(void) const { return head == tail; }
+
+  /*!
+   * @brief Number of audio bytes waiting for the consumer
+   * @return Byte count
+   */
+  uint16_t bytes(void) const
+  {
+    uint16_t n = 0;
+    for (uint8_t i = tail; i != head; i++)
+      n += len[i % AUDIORING_CHUNKS];
+    return n;
+  }
+
+  /*!
+   * @brief Producer: test if a whole sector can be written
+   * @return Returns true if sectorBuffer() may be filled
+   */
+  bool sectorFree(void) const
+  {
+    return (uint8_t)(AUDIORING_CHUNKS - fill()) >= AUDIORING_SECTORCHUNKS;
+  }
+
+  /*!
+   * @brief Producer: free sectors that follow sectorBuffer() in RAM without
+   * wrapping, for reading several sectors at once
+   * @return Sector count, 0 if sectorFree() is false
+   */
+  uint8_t sectorsFreeLinear(void) const
+  {
+    uint16_t free = (AUDIORING_CHUNKS - fill()) / AUDIORING_SECTORCHUNKS;
+    uint16_t toEnd = (AUDIORING_CHUNKS - head % AUDIORING_CHUNKS) / AUDIORING_SECTORCHUNKS;
+    return (free < toEnd) ? free : toEnd;
+  }
+
+  /*!
+   * @brief Producer: sector aligned buffer to read the next sector into
+   * @return Pointer to AUDIORING_SECTORLEN bytes
+   */
+  uint8_t *sectorBuffer(void)
+  {
+    return data + (head % AUDIORING_CHUNKS) * AUDIORING_CHUNKLEN;
+  }
+
+  /*!
+   * @brief Producer: publish the sector written to sectorBuffer()
+   * @param n Number of valid bytes in the sector
+   */
+  void commitSector(uint16_t n)
+  {
+    uint8_t c = head % AUDIORING_CHUNKS;
+    for (uint8_t i = 0; i < AUDIORING_SECTORCHUNKS; i++)
+    {
+      len[c + i] = (n > AUDIORING_CHUNKLEN) ? AUDIORING_CHUNKLEN : n;
+      n -= len[c + i];
+    }
+    AUDIORING_BARRIER();
+    head = head + AUDIORING_SECTORCHUNKS;
+  }
+
+  /*!
+   * @brief Consumer: oldest chunk in the ring
+   * @return Pointer to chunkLen() bytes
+   */
+  uint8_t *chunk(void)
+  {
+    return data + (tail % AUDIORING_CHUNKS) * AUDIORING_CHUNKLEN;
+  }
+
+  /*!
+   * @brief Consumer: length of the oldest chunk, may be 0
+   * @return Byte count
+   */
+  uint8_t chunkLen(void) const { return len[tail % AUDIORING_CHUNKS]; }
+
+  /*!
+   * @brief Consumer: release the oldest chunk
+   */
+  void pop(void)
+  {
+    AUDIORING_BARRIER();
+    tail = tail + 1;
+  }
+
+  /*!
+   * @brief Consumer: release everything published so far
+   */
+  void discard(void) { tail = head; }
+
+  uint8_t data[AUDIORING_CHUNKS * AUDIORING_CHUNKLEN]; //!< ring storage
+
+private:
+  volatile uint8_t head = 0;      //!< next chunk the producer writes
+  volatile uint8_t tail = 0;      //!< next chunk the consumer reads
+  uint8_t len[AUDIORING_CHUNKS]; //!< valid bytes per chunk
+};
+
+#endif // ADAMISCH_AUDIORING_H
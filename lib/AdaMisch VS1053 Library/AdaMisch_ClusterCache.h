@@ -0,0 +1,108 @@
+/*!
+ * @file AdaMisch_ClusterCache.h
+ *
+ * Sparse copy of the cluster chain of the playing file. Every stride-th
+ * cluster number is kept, filled in lazily whenever the chain is walked, so
+ * the cluster at any file position is reached from the nearest entry below it
+ * with at most stride - 1 FAT lookups instead of a walk from the first
+ * cluster. The stride is chosen per file so VS1053_CLUSTERCACHE entries cover
+ * the whole chain.
+ *
+ * The last cluster looked up is kept as well, sequential reads advance from it
+ * with a single lookup.
+ *
+ * No Arduino headers are used here so the cache can be benchmarked on the
+ * host against a FAT image.
+ */
+
+#ifndef ADAMISCH_CLUSTERCACHE_H
+#define ADAMISCH_CLUSTERCACHE_H
+
+#include <stdint.h>
+
+#ifndef VS1053_CLUSTERCACHE
+#define VS1053_CLUSTERCACHE 32 //!< Cached chain entries, 4 bytes each, 0 disables the cache
+#endif
+
+/*!
+ * @brief Follow the FAT
+ * @param ctx Volume
+ * @param cluster Cluster to look up
+ * @param next Cluster that follows it
+ * @return Returns false at the end of the chain or on a read error
+ */
+typedef bool (*ClusterNext)(void *ctx, uint32_t cluster, uint32_t *next);
+
+/*!
+ * @brief Every stride-th cluster of a file's chain
+ */
+class ClusterCache
+{
+public:
+  /*!
+   * @brief Start over with a new file
+   * @param firstCluster First cluster of the file, 0 for an empty file
+   * @param clusters Clusters the file spans
+   */
+  void reset(uint32_t firstCluster, uint32_t clusters)
+  {
+    _stride = (clusters + ENTRIES - 1) / ENTRIES;
+    if (_stride == 0)
+      _stride = 1;
+    _entry[0] = firstCluster;
+    _built = firstCluster ? 1 : 0;
+    _cur = firstCluster;
+    _curIndex = 0;
+  }
+
+  /*!
+   * @brief Cluster number of the n-th cluster of the file
+   * @param n Cluster index, file position / bytes per cluster
+   * @param next FAT lookup
+   * @param ctx Passed to next
+   * @param cluster Receives the cluster number
+   * @return Returns false if the chain is shorter or the FAT can't be read
+   */
+  bool locate(uint32_t n, ClusterNext next, void *ctx, uint32_t *cluster)
+  {
+    if (_built == 0)
+      return false;
+    uint16_t e = n / _stride;
+    if (e >= _built)
+      e = _built - 1;
+    uint32_t i = (uint32_t)e * _stride;
+    uint32_t c = _entry[e];
+    if (_curIndex <= n && _curIndex > i)
+    {
+      // the last lookup is closer than the cache entry
+      i = _curIndex;
+      c = _cur;
+    }
+    while (i < n)
+    {
+      if (!next(ctx, c, &c))
+        return false;
+      i++;
+      lookups++;
+      if (i % _stride == 0 && i / _stride == _built && _built < ENTRIES)
+        _entry[_built++] = c;
+    }
+    _cur = c;
+    _curIndex = n;
+    *cluster = c;
+    return true;
+  }
+
+  uint32_t lookups = 0; //!< FAT lookups done by locate(), for benchmarks
+
+private:
+  static const uint16_t ENTRIES = VS1053_CLUSTERCACHE ? VS1053_CLUSTERCACHE : 1;
+
+  uint32_t _entry[ENTRIES]; //!< cluster number of index i * _stride
+  uint32_t _stride = 1;     //!< chain clusters per entry
+  uint16_t _built = 0;      //!< entries filled in so far
+  uint32_t _cur = 0;        //!< cluster of the last lookup
+  uint32_t _curIndex = 0;   //!< its index in the chain
+};
+
+#endif // ADAMISCH_CLUSTERCACHE_H
@@ -0,0 +1,91 @@
+/*!
+ * @file AdaMisch_FastPin.h
+ *
+ * Pin access resolved at compile time. For a constant pin number the port
+ * register address and the bit mask are constants, so avr-gcc emits a single
+ * sbi/cbi/sbis for ports A to G. Ports H to L lie outside the I/O space and
+ * need lds/ori/sts, which is still far below digitalWrite().
+ *
+ * The pin tables cover the ATmega2560 (Mega) and the ATmega328P (Uno). Other
+ * targets fall back to digitalWrite()/digitalRead().
+ */
+
+#ifndef ADAMISCH_FASTPIN_H
+#define ADAMISCH_FASTPIN_H
+
+#include <Arduino.h>
+
+#if defined(__AVR_ATmega2560__) || defined(__AVR_ATmega328P__)
+#define VS1053_FASTPIN_AVR //!< compile time pin tables are available
+
+// port letter index (A=0 ... L=11) in the upper nibble, bit in the lower one
+#define FP(port, bit) (((port) << 4) | (bit))
+enum
+{
+  FP_A, FP_B, FP_C, FP_D, FP_E, FP_F, FP_G, FP_H, FP_J, FP_K, FP_L
+};
+
+#if defined(__AVR_ATmega2560__)
+//! port/bit of every Arduino pin, same order as digital_pin_to_port_PGM
+static constexpr uint8_t fastPinMap[] = {
+    FP(FP_E, 0), FP(FP_E, 1), FP(FP_E, 4), FP(FP_E, 5), FP(FP_G, 5), // 0-4
+    FP(FP_E, 3), FP(FP_H, 3), FP(FP_H, 4), FP(FP_H, 5), FP(FP_H, 6), // 5-9
+    FP(FP_B, 4), FP(FP_B, 5), FP(FP_B, 6), FP(FP_B, 7), FP(FP_J, 1), // 10-14
+    FP(FP_J, 0), FP(FP_H, 1), FP(FP_H, 0), FP(FP_D, 3), FP(FP_D, 2), // 15-19
+    FP(FP_D, 1), FP(FP_D, 0), FP(FP_A, 0), FP(FP_A, 1), FP(FP_A, 2), // 20-24
+    FP(FP_A, 3), FP(FP_A, 4), FP(FP_A, 5), FP(FP_A, 6), FP(FP_A, 7), // 25-29
+    FP(FP_C, 7), FP(FP_C, 6), FP(FP_C, 5), FP(FP_C, 4), FP(FP_C, 3), // 30-34
+    FP(FP_C, 2), FP(FP_C, 1), FP(FP_C, 0), FP(FP_D, 7), FP(FP_G, 2), // 35-39
+    FP(FP_G, 1), FP(FP_G, 0), FP(FP_L, 7), FP(FP_L, 6), FP(FP_L, 5), // 40-44
+    FP(FP_L, 4), FP(FP_L, 3), FP(FP_L, 2), FP(FP_L, 1), FP(FP_L, 0), // 45-49
+    FP(FP_B, 3), FP(FP_B, 2), FP(FP_B, 1), FP(FP_B, 0), FP(FP_F, 0), // 50-54
+    FP(FP_F, 1), FP(FP_F, 2), FP(FP_F, 3), FP(FP_F, 4), FP(FP_F, 5), // 55-59
+    FP(FP_F, 6), FP(FP_F, 7), FP(FP_K, 0), FP(FP_K, 1), FP(FP_K, 2), // 60-64
+    FP(FP_K, 3), FP(FP_K, 4), FP(FP_K, 5), FP(FP_K, 6), FP(FP_K, 7), // 65-69
+};
+//! data space address of the PINx register, PORTx is PINx + 2
+static constexpr uint16_t fastPinPortBase[] = {
+    0x20, 0x23, 0x26, 0x29, 0x2C, 0x2F, 0x32, 0x100, 0x103, 0x106, 0x109};
+#else
+static constexpr uint8_t fastPinMap[] = {
+    FP(FP_D, 0), FP(FP_D, 1), FP(FP_D, 2), FP(FP_D, 3), FP(FP_D, 4), // 0-4
+    FP(FP_D, 5), FP(FP_D, 6), FP(FP_D, 7), FP(FP_B, 0), FP(FP_B, 1), // 5-9
+    FP(FP_B, 2), FP(FP_B, 3), FP(FP_B, 4), FP(FP_B, 5), FP(FP_C, 0), // 10-14
+    FP(FP_C, 1), FP(FP_C, 2), FP(FP_C, 3), FP(FP_C, 4), FP(FP_C, 5), // 15-19
+};
+static constexpr uint16_t fastPinPortBase[] = {0, 0x23, 0x26, 0x29};
+#endif
+#undef FP
+
+//! address of the PINx register of an Arduino pin
+constexpr uint16_t fastPinInput(uint8_t pin)
+{
+  return fastPinPortBase[fastPinMap[pin] >> 4];
+}
+
+//! bit mask of an Arduino pin within its port
+constexpr uint8_t fastPinMask(uint8_t pin)
+{
+  return 1 << (fastPinMap[pin] & 0x0F);
+}
+#endif
+
+/*!
+ * @brief Arduino pin with port and mask known at compile time
+ * @tparam PIN Arduino pin number
+ */
+template <uint8_t PIN> struct FastPin
+{
+#if defined(VS1053_FASTPIN_AVR)
+  static_assert(PIN < sizeof(fastPinMap), "pin not in fastPinMap");
+  static inline void high(void) { _SFR_MEM8(fastPinInput(PIN) + 2) |= fastPinMask(PIN); }
+  static inline void low(void) { _SFR_MEM8(fastPinInput(PIN) + 2) &= ~fastPinMask(PIN); }
+  static inline boolean read(void) { return (_SFR_MEM8(fastPinInput(PIN)) & fastPinMask(PIN)) != 0; }
+#else
+  static inline void high(void) { digitalWrite(PIN, HIGH); }
+  static inline void low(void) { digitalWrite(PIN, LOW); }
+  static inline boolean read(void) { return digitalRead(PIN); }
+#endif
+};
+
+#endif // ADAMISCH_FASTPIN_H
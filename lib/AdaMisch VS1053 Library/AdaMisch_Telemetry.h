@@ -0,0 +1,73 @@
+/*!
+ * @file AdaMisch_Telemetry.h
+ *
+ * Playback health counters of the file player, to tell a slow card from
+ * feeder collisions or a starved decoder. The feeder updates the counters
+ * as it runs, the main loop samples the decoder every
+ * VS1053_TELEMETRY_INTERVAL and Adafruit_VS1053_FilePlayer::telemetry()
+ * hands out a consistent copy.
+ */
+
+#ifndef ADAMISCH_TELEMETRY_H
+#define ADAMISCH_TELEMETRY_H
+
+#include <stdint.h>
+
+#ifndef VS1053_TELEMETRY
+#define VS1053_TELEMETRY 1 //!< 0 leaves the timing out of the feeder
+#endif
+
+#ifndef VS1053_TELEMETRY_INTERVAL
+#define VS1053_TELEMETRY_INTERVAL 1000 //!< ms between two decoder samples
+#endif
+
+#define VS1053_FEEDBINS 8         //!< bins of the feed time histogram
+#define VS1053_FEEDBIN0_MICROS 32 //!< upper bound of bin 0, each next bin is twice as wide
+
+/*!
+ * @brief Snapshot of the playback health counters
+ */
+struct VS1053_Telemetry
+{
+  uint16_t starved;                   //!< DREQ requests that found no data to send
+  uint16_t feedBins[VS1053_FEEDBINS]; //!< feedBuffer() runs by duration, last bin open ended
+  uint16_t feedMaxMicros;             //!< longest feedBuffer() run
+  uint32_t fedBytes;                  //!< audio bytes sent to the decoder
+  uint16_t fedKbps;                   //!< feed rate during the last interval
+  uint16_t bitrate;                   //!< kbit/s of the stream from HDAT0/HDAT1, 0 if unknown
+  uint16_t decodeTime;                //!< DECODETIME in seconds at the last sample
+  uint16_t speed;                     //!< play speed in percent, the decoder needs bitrate * speed / 100
+  uint32_t isrMicros;                 //!< time spent in the feeder interrupts
+  uint16_t isrPermille;               //!< their CPU share during the last interval
+  uint16_t edgesHeld;                 //!< DREQ edges the hybrid scheduler left to its tick
+  uint16_t tickFeeds;                 //!< hybrid ticks that found DREQ high and fed
+  uint16_t recoveries;                //!< decoder stalls the watchdog recovered from
+  uint16_t stallSkips;                //!< tracks the watchdog gave up on after a hardware reset
+  uint32_t sampleMillis;              //!< millis() of the last sample
+
+  /*!
+   * @brief Add a feedBuffer() run to the histogram
+   * @param us Duration of the run
+   */
+  void countFeed(uint32_t us)
+  {
+    uint8_t bin = 0;
+    for (uint32_t limit = VS1053_FEEDBIN0_MICROS; us >= limit && bin < VS1053_FEEDBINS - 1; limit <<= 1)
+      bin++;
+    feedBins[bin]++;
+    if (us > feedMaxMicros)
+      feedMaxMicros = (us > 0xFFFF) ? 0xFFFF : us;
+  }
+
+  /*!
+   * @brief Upper bound of a histogram bin
+   * @param bin Bin number
+   * @return Microseconds, the last bin has none and returns 0
+   */
+  static uint16_t binLimit(uint8_t bin)
+  {
+    return (bin < VS1053_FEEDBINS - 1) ? VS1053_FEEDBIN0_MICROS << bin : 0;
+  }
+};
+
+#endif // ADAMISCH_TELEMETRY_H
@@ -38,31 +38,38 @@ static Adafruit_VS1053_FilePlayer *myself;
 #if defined(ARDUINO_ARCH_AVR)
 SIGNAL(TIMER0_COMPA_vect)
 {
-  myself->feedBuffer();
+  myself->feedTick();
 }
 #endif
 
-volatile boolean feedBufferLock = false; //!< Locks feeding the buffer
+volatile boolean feedBufferLock = false;    //!< Locks feeding the buffer
+volatile boolean feedBufferPending = false; //!< A request arrived while locked
+
+// the lock sections return to the interrupt state they found, a feeder
+// running in an interrupt handler must not let nested interrupts in
+#if defined(SREG)
+#define FEEDER_IRQ_SAVE() uint8_t feederSreg = SREG
+#define FEEDER_IRQ_RESTORE() (SREG = feederSreg)
+#else
+#define FEEDER_IRQ_SAVE()
+#define FEEDER_IRQ_RESTORE() interrupts()
+#endif
 
 #if defined(ESP8266)
 ICACHE_RAM_ATTR
 #endif
 static void feeder(void)
 {
-  myself->feedBuffer();
+  myself->feedEdge();
 }
 
-#define VS1053_CONTROL_SPI_SETTING \
-  SPISettings(250000, MSBFIRST, SPI_MODE0) //!< VS1053 SPI control settings
-#define VS1053_DATA_SPI_SETTING \
-  SPISettings(8000000, MSBFIRST, SPI_MODE0) //!< VS1053 SPI data settings
-
 boolean Adafruit_VS1053_FilePlayer::useInterrupt(uint8_t type)
 {
   myself = this; // oy vey
 
   if (type == VS1053_FILEPLAYER_TIMER0_INT)
   {
+    _scheduler = type;
 #if defined(ARDUINO_ARCH_AVR)
     OCR0A = 0xAF;
     TIMSK0 |= _BV(OCIE0A);
@@ -93,7 +100,7 @@ boolean Adafruit_VS1053_FilePlayer::useInterrupt(uint8_t type)
     return false;
 #endif
   }
-  if (type == VS1053_FILEPLAYER_PIN_INT)
+  if (type == VS1053_FILEPLAYER_PIN_INT || type == VS1053_FILEPLAYER_HYBRID_INT)
   {
     int8_t irq = digitalPinToInterrupt(_dreq);
     // Serial.print("Using IRQ "); Serial.println(irq);
@@ -103,6 +110,29 @@ boolean Adafruit_VS1053_FilePlayer::useInterrupt(uint8_t type)
     !defined(ARDUINO_STM32_FEATHER)
     SPI.usingInterrupt(irq);
 #endif
+    if (type == VS1053_FILEPLAYER_HYBRID_INT)
+    {
+#if defined(ARDUINO_ARCH_AVR) && defined(EIMSK)
+      // the tick must not feed inside another device's SPI transaction,
+      // these mask the DREQ interrupt while they run
+      detachInterrupt(irq);
+      uint8_t others = EIMSK;
+      _edgeHold = false;
+      _tickCount = 0;
+      _scheduler = type;
+      attachInterrupt(irq, feeder, RISING);
+      _dreqIntMask = EIMSK & ~others;
+      OCR0A = 0xAF;
+      TIMSK0 |= _BV(OCIE0A);
+      return true;
+#else
+      return false;
+#endif
+    }
+#if defined(ARDUINO_ARCH_AVR)
+    TIMSK0 &= ~_BV(OCIE0A); // no tick outside of the hybrid scheduler
+#endif
+    _scheduler = type;
     attachInterrupt(irq, feeder, CHANGE);
     return true;
   }
@@ -159,9 +189,10 @@ boolean Adafruit_VS1053_FilePlayer::playFullFile(const char *trackname)
   if (!startPlayingFile(trackname))
     return false;
 
-  while (playingMusic)
+  while (playingMusic || ending())
   {
     // twiddle thumbs
+    feedRing();
     feedBuffer();
     delay(5); // give IRQs a chance
   }
@@ -171,20 +202,242 @@ boolean Adafruit_VS1053_FilePlayer::playFullFile(const char *trackname)
 
 uint32_t Adafruit_VS1053_FilePlayer::stopPlaying(void)
 {
-  // cancel all playback
-  sciWrite(VS1053_REG_MODE, VS1053_MODE_SM_LINE1 | VS1053_MODE_SM_SDINEW |
-                                VS1053_MODE_SM_CANCEL);
-
   // wrap it up!
+  boolean active = playingMusic || currentTrack;
   playingMusic = false;
-  uint32_t position = currentTrack.position();
+  _startState = VS1053_START_NONE;
+  uint32_t position = trackPosition();
   currentTrack.close();
+  _nextTrack.close();
+  _gapWatch = false;
+  _starving = false;
+  _ring.reset();
+
+  // cancel all playback, feedRing() sends the fill bytes that complete it
+  if (active && (_endState == VS1053_END_IDLE || _endState == VS1053_END_DRAIN))
+    beginCancel(true);
+  updateStatus();
   return position;
 }
 
+boolean Adafruit_VS1053_FilePlayer::ending(void)
+{
+  return _endState != VS1053_END_IDLE;
+}
+
+// end fill byte of the current stream format into the fill buffer
+void Adafruit_VS1053_FilePlayer::loadEndFill(void)
+{
+  sciWrite(VS1053_REG_WRAMADDR, VS1053_PARA_ENDFILLBYTE);
+  memset(mp3buffer, sciRead(VS1053_REG_WRAM) & 0xFF, VS1053_DATABUFFERLEN);
+}
+
+void Adafruit_VS1053_FilePlayer::enterEnd(VS1053_EndState state)
+{
+  _endState = state;
+  _endBytes = 0;
+  _endStart = millis();
+  _endMark = 0;
+  if (state == VS1053_END_DRAIN)
+    _endDecodeTime = decodeTime();
+}
+
+// the drain still gets somewhere: the decoder takes fill bytes or its play
+// time advances, both stall together only if it stopped
+boolean Adafruit_VS1053_FilePlayer::endMoving(void)
+{
+  uint16_t t = decodeTime();
+  boolean moving = (_endBytes != _endMark) || (t != _endDecodeTime);
+  _endMark = _endBytes;
+  _endDecodeTime = t;
+  return moving;
+}
+
+// set SM_CANCEL, the decoder stops at the next frame and clears the bit
+void Adafruit_VS1053_FilePlayer::beginCancel(boolean flush)
+{
+  loadEndFill();
+  sciWrite(VS1053_REG_MODE, sciRead(VS1053_REG_MODE) | VS1053_MODE_SM_CANCEL);
+  _endFlush = flush;
+  enterEnd(VS1053_END_CANCEL);
+}
+
+// the cancel was not acknowledged, soft reset without the delay of softReset()
+void Adafruit_VS1053_FilePlayer::resetDecoder(void)
+{
+  _endVolume = sciRead(VS1053_REG_VOLUME);
+  sciWrite(VS1053_REG_MODE, VS1053_MODE_SM_SDINEW | VS1053_MODE_SM_RESET);
+  sciSafeClock();
+  _patchesActive = false;
+  enterEnd(VS1053_END_RESET);
+}
+
+// advance the end sequence as far as DREQ allows, never waits for the decoder
+boolean Adafruit_VS1053_FilePlayer::endStep(void)
+{
+  if (_endState == VS1053_END_IDLE)
+    return true;
+
+  uint32_t elapsed = millis() - _endStart;
+  if (_endState == VS1053_END_RESET)
+  {
+    // DREQ drops for the reset and rises once the decoder is back
+    if (elapsed < 2 || (!readyForData() && elapsed < VS1053_CANCEL_TIMEOUT))
+      return false;
+    setClock(_clockf ? _clockf : VS1053_CLOCKF);
+    // the feeder keeps off the card while no file plays or a start is armed
+    if (_patchFile)
+      reloadPatches();
+    sciWrite(VS1053_REG_VOLUME, _endVolume);
+    if (_speed != 100)
+      applySpeed();
+    _endState = VS1053_END_IDLE;
+    return true;
+  }
+  if (elapsed >= ((_endState == VS1053_END_DRAIN) ? VS1053_DRAIN_TIMEOUT : VS1053_CANCEL_TIMEOUT))
+  {
+    // a low bitrate or a slow play speed takes longer to play out the
+    // decoder's buffer, that is no reason to cut the tail
+    if (_endState == VS1053_END_DRAIN && endMoving())
+    {
+      _endStart = millis();
+      return false;
+    }
+    cancelResets++;
+    resetDecoder(); // decoder stuck, DREQ stays low
+    return false;
+  }
+
+  while (readyForData())
+  {
+    uint16_t left = ((_endState == VS1053_END_CANCEL) ? VS1053_CANCEL_BYTES
+                                                      : VS1053_ENDFILL_BYTES) - _endBytes;
+    uint8_t len = (left < VS1053_DATABUFFERLEN) ? left : VS1053_DATABUFFERLEN;
+    playData(mp3buffer, len);
+    _endBytes += len;
+
+    if (_endState == VS1053_END_CANCEL)
+    {
+      // checked after every 32 bytes
+      if (!(sciRead(VS1053_REG_MODE) & VS1053_MODE_SM_CANCEL))
+      {
+        if (!_endFlush)
+        {
+          _endState = VS1053_END_IDLE;
+          return true;
+        }
+        loadEndFill();
+        enterEnd(VS1053_END_FLUSH);
+      }
+      else if (_endBytes >= VS1053_CANCEL_BYTES)
+      {
+        cancelResets++;
+        resetDecoder();
+        return false;
+      }
+    }
+    else if (_endBytes >= VS1053_ENDFILL_BYTES)
+    {
+      if (_endState == VS1053_END_FLUSH)
+      {
+        _endState = VS1053_END_IDLE;
+        return true;
+      }
+      // the last frames are out, cancel so the decoder is clean for the next file
+      beginCancel(false);
+    }
+  }
+  return false;
+}
+
+void Adafruit_VS1053_FilePlayer::feedEdge(void)
+{
+  // interrupt handlers run with interrupts off from entry to exit, the
+  // feeder lock restores that state, so the whole run counts as off time
+  uint32_t start = micros();
+  // on top of a main loop feeder only the rerun request is left to make,
+  // the bookkeeping belongs to the run that holds the lock
+  if (_scheduler == VS1053_FILEPLAYER_HYBRID_INT && !feedBufferLock)
+  {
+    if (_edgeHold)
+    {
+      _telemetry.edgesHeld++;
+      return;
+    }
+    _burst = 0; // stays 0 if the feeder found nothing to do
+    feedBuffer();
+    if (_burst < VS1053_HYBRID_MINBURST)
+      _edgeHold = true; // FIFO nearly full, edges would come every 32 bytes
+  }
+  else
+  {
+    feedBuffer();
+  }
+  countIsr(micros() - start);
+}
+
+void Adafruit_VS1053_FilePlayer::feedTick(void)
+{
+  if (_scheduler == VS1053_FILEPLAYER_HYBRID_INT)
+  {
+    if (++_tickCount < VS1053_HYBRID_TICK)
+      return;
+    _tickCount = 0;
+    _edgeHold = false;
+#if defined(EIMSK)
+    if (!(EIMSK & _dreqIntMask))
+      return; // inside an SPI transaction, its end lets latched edges through
+#endif
+    if (feedBufferLock || !playingMusic || !readyForData())
+      return; // a running feeder serves DREQ itself
+    _telemetry.tickFeeds++;
+  }
+  uint32_t start = micros();
+  feedBuffer();
+  countIsr(micros() - start);
+}
+
+void Adafruit_VS1053_FilePlayer::countIsr(uint32_t us)
+{
+  countIrqOff(us);
+  _telemetry.isrMicros += us;
+}
+
+// an armed start goes once the previous file is out of the decoder
+void Adafruit_VS1053_FilePlayer::startStream(void)
+{
+  if (_startState != VS1053_START_ARMED || !endStep())
+    return;
+
+  // reset playback
+  sciWrite(VS1053_REG_MODE, VS1053_MODE_SM_LINE1 | VS1053_MODE_SM_SDINEW |
+                                VS1053_MODE_SM_LAYER12);
+  // resync
+  sciWrite(VS1053_REG_WRAMADDR, 0x1e29);
+  sciWrite(VS1053_REG_WRAM, 0);
+
+  // As explained in datasheet, set twice 0 in REG_DECODETIME to set time back
+  // to 0
+  sciWrite(VS1053_REG_DECODETIME, 0x00);
+  sciWrite(VS1053_REG_DECODETIME, 0x00);
+
+  _wdSample = 0;
+  _wdGoodPos = trackPosition();
+  _startState = VS1053_START_FEEDING;
+
+  // DREQ may be high already, there won't be an edge to start the interrupt
+  feedBuffer();
+}
+
+VS1053_StartState Adafruit_VS1053_FilePlayer::startState(void)
+{
+  return _startState;
+}
+
 void Adafruit_VS1053_FilePlayer::pausePlaying(boolean pause)
 {
   playingMusic = (!pause && currentTrack);
+  updateStatus();
   if (playingMusic)
   {
     feedBuffer();
@@ -193,12 +446,12 @@ void Adafruit_VS1053_FilePlayer::pausePlaying(boolean pause)
 
 boolean Adafruit_VS1053_FilePlayer::paused(void)
 {
-  return (!playingMusic && currentTrack);
+  return (!playingMusic && currentTrack && !_trackDone);
 }
 
 boolean Adafruit_VS1053_FilePlayer::stopped(void)
 {
-  return (!playingMusic && !currentTrack);
+  return (!playingMusic && !currentTrack && _endState == VS1053_END_IDLE);
 }
 
 // Just checks to see if the name ends in ".mp3"
@@ -264,199 +517,887 @@ unsigned long Adafruit_VS1053_FilePlayer::mp3_ID3Jumper(File mp3)
   return start;
 }
 
+// first card block of a contiguous file, 0 if it is fragmented
+static uint32_t contiguousStart(File *file)
+{
+  uint32_t bgnBlock, endBlock;
+  return file->contiguousRange(&bgnBlock, &endBlock) ? bgnBlock : 0;
+}
+
+static void countRead(VS1053_ReadStats *stats, uint16_t bytes, uint32_t us)
+{
+  stats->reads++;
+  stats->bytes += bytes;
+  stats->micros += us;
+  if (us > stats->maxMicros)
+    stats->maxMicros = (us > 0xFFFF) ? 0xFFFF : us;
+}
+
 boolean Adafruit_VS1053_FilePlayer::startPlayingFile(const char *trackname)
 {
-  // reset playback
-  sciWrite(VS1053_REG_MODE, VS1053_MODE_SM_LINE1 | VS1053_MODE_SM_SDINEW |
-                                VS1053_MODE_SM_LAYER12);
-  // resync
-  sciWrite(VS1053_REG_WRAMADDR, 0x1e29);
-  sciWrite(VS1053_REG_WRAM, 0);
+  return startPlayingFile(trackname, 0);
+}
+
+boolean Adafruit_VS1053_FilePlayer::startPlayingFile(const char *trackname, uint32_t position,
+                                                     uint32_t audioStart)
+{
+  // keep the feeder away from the old file and the ring
+  playingMusic = false;
+  _wdLevel = 0;
+  _trackId++;
+  cancelPrevious();
 
   currentTrack = SD.open(trackname);
   if (!currentTrack)
   {
+    updateStatus();
     return false;
   }
+  return startPlayingOpened(position, audioStart, isMP3File(trackname));
+}
+
+boolean Adafruit_VS1053_FilePlayer::startPlayingEntry(FatFile *dir, uint16_t entryIndex,
+                                                      uint32_t position, uint32_t audioStart)
+{
+  // keep the feeder away from the old file and the ring
+  playingMusic = false;
+  _wdLevel = 0;
+  _trackId++;
+  cancelPrevious();
 
+  // one directory entry read, no path walk
+  currentTrack.close();
+  if (!currentTrack.open(dir, entryIndex, O_READ))
+  {
+    updateStatus();
+    return false;
+  }
+  return startPlayingOpened(position, audioStart, true);
+}
+
+// the decoder still holds data of the file that is replaced, playing, paused or
+// played to the end and draining: cancel it, a new stream must not follow a partial frame
+void Adafruit_VS1053_FilePlayer::cancelPrevious(void)
+{
+  if ((currentTrack && _endState == VS1053_END_IDLE) || _endState == VS1053_END_DRAIN)
+    beginCancel(true); // a new file is waiting, the tail of the last one is dropped
+}
+
+// everything after the file is open, shared by startPlayingFile() and startPlayingEntry()
+boolean Adafruit_VS1053_FilePlayer::startPlayingOpened(uint32_t position, uint32_t audioStart,
+                                                       boolean mp3)
+{
   // We know we have a valid file. Check if .mp3
-  // If so, check for ID3 tag and jump it if present.
-  if (isMP3File(trackname))
+  // If so, go to specified file position
+  _seekInfoValid = false;
+  openRead(contiguousStart(&currentTrack));
+  if (position != 0)
+  {
+    if (_resumeRewind && loadSeekInfo())
+    {
+      // resume a little earlier, on a frame boundary
+      uint32_t ms = mp3OffsetToTime(&_seekInfo, position);
+      uint32_t back = _resumeRewind * 1000UL;
+      position = frameOffset((ms > back) ? ms - back : 0);
+    }
+    seekRead(position); // jump to given position
+  }
+  else if (audioStart != VS1053_AUDIOSTART_PROBE)
+  {
+    seekRead(audioStart); // start is known, no need to probe
+  }
+  else
+  {
+    // if .mp3, check for ID3 tag and jump it if present.
+    if (mp3)
+    {
+      seekRead(mp3_ID3Jumper(currentTrack));
+    }
+  }
+
+  seekPosition = -1;
+  _fedPosition = readPosition(); // the feeder is off, see playingMusic above
+  _trackDone = false;
+  _nextTrack.close();
+  _gapWatch = false;
+  _starving = false;
+  if (_useRing)
+  {
+    // consumer is idle, prefill the ring before the first DREQ arrives
+    _ring.reset();
+    _ringEof = false;
+    _ringDiscard = false;
+    feedRing();
+  }
+
+#ifdef VS1053_SYNC_START
+  // the former blocking start, kept to compare irqOffMaxMicros against
+  while (_endState != VS1053_END_IDLE)
+    endStep();
+  _startState = VS1053_START_ARMED;
+  uint32_t irqStart = irqOff();
+  startStream();
+  playingMusic = true;
+  while (!readyForData())
+    ;
+  while (playingMusic && readyForData())
+    feedBuffer();
+  irqOn(irqStart);
+#else
+  // armed with interrupts on, the feeder keeps off the decoder until
+  // startStream() reset it, see startState()
+  _startState = VS1053_START_ARMED;
+  playingMusic = true;
+  startStream();
+#endif
+
+  updateStatus();
+  return true;
+}
+
+long Adafruit_VS1053_FilePlayer::fileSize(void)
+{
+  if (playingMusic)
   {
-    currentTrack.seek(mp3_ID3Jumper(currentTrack));
+    return currentTrack.size();
   }
+  else
+  {
+    return -1;
+  }
+}
 
-  // don't let the IRQ get triggered by accident here
+long Adafruit_VS1053_FilePlayer::filePosition(void)
+{
+  if (playingMusic)
+  {
+    return trackPosition();
+  }
+  else
+  {
+    return -1;
+  }
+}
+
+void Adafruit_VS1053_FilePlayer::fileSeek(long position)
+{
+  if (playingMusic) {
+    seekPosition = position;
+    // counts as done, the consumer drops the ring before it sends more
+    uint32_t start = irqOff();
+    _fedPosition = position;
+    irqOn(start);
+    updateStatus();
+  }
+}
+
+boolean Adafruit_VS1053_FilePlayer::seekSeconds(int16_t seconds)
+{
+  if (!playingMusic || !loadSeekInfo())
+    return false;
+
+  int32_t ms = (int32_t)positionMillis() + seconds * 1000L;
+  if (ms < 0)
+    ms = 0;
+  if ((uint32_t)ms >= _seekInfo.duration)
+    return false; // end of track, let the caller decide what comes next
+  return seekMillis(ms);
+}
+
+boolean Adafruit_VS1053_FilePlayer::seekPercent(uint8_t percent)
+{
+  if (!playingMusic || !loadSeekInfo() || percent >= 100)
+    return false;
+  return seekMillis((uint64_t)_seekInfo.duration * percent / 100);
+}
+
+uint32_t Adafruit_VS1053_FilePlayer::positionMillis(void)
+{
+  if (!currentTrack || !loadSeekInfo())
+    return 0;
+  // a seek that is not taken yet counts as done, so steps add up
+  long pending = seekPosition;
+  return mp3OffsetToTime(&_seekInfo, (pending != -1) ? pending : trackPosition());
+}
+
+uint32_t Adafruit_VS1053_FilePlayer::millisAt(uint32_t position)
+{
+  if (!currentTrack || !loadSeekInfo())
+    return 0;
+  return mp3OffsetToTime(&_seekInfo, position);
+}
+
+uint32_t Adafruit_VS1053_FilePlayer::durationMillis(void)
+{
+  if (!currentTrack || !loadSeekInfo())
+    return 0;
+  return _seekInfo.duration;
+}
+
+void Adafruit_VS1053_FilePlayer::setResumeRewind(uint8_t seconds)
+{
+  _resumeRewind = seconds;
+}
+
+boolean Adafruit_VS1053_FilePlayer::seekMillis(uint32_t ms)
+{
+  fileSeek(frameOffset(ms));
+  return true;
+}
+
+// parse the frame and Xing/VBRI headers once per track
+boolean Adafruit_VS1053_FilePlayer::loadSeekInfo(void)
+{
+  if (_seekInfoValid)
+    return true;
+  if (!currentTrack || (playingMusic && !_useRing))
+    return false; // without the ring the file belongs to the interrupt
+
+  uint32_t position = currentTrack.position();
+  _scratchBlock = 0; // the SdFat cache buffer may hold anything by now
+  _seekInfoValid = mp3ReadSeekInfo(readTrack, this, 0,
+                                   currentTrack.size(), &_seekInfo);
+  currentTrack.seek(position);
+  return _seekInfoValid;
+}
+
+// file offset of the first frame at or after a play time
+uint32_t Adafruit_VS1053_FilePlayer::frameOffset(uint32_t ms)
+{
+  uint32_t position = currentTrack.position();
+  uint32_t target = mp3TimeToOffset(&_seekInfo, ms);
+  mp3FrameHeader h;
+  _scratchBlock = 0;
+  int32_t sync = mp3FindFrame(readTrack, this, target,
+                              2 * MP3_MAX_FRAMELEN, &_seekInfo, &h);
+  currentTrack.seek(position);
+  return (sync >= 0) ? sync : target;
+}
+
+int Adafruit_VS1053_FilePlayer::readTrack(void *player, uint32_t pos,
+                                          uint8_t *buf, uint16_t len)
+{
+  Adafruit_VS1053_FilePlayer *p = (Adafruit_VS1053_FilePlayer *)player;
+  if (p->_rawBlock || p->_rawChain)
+    return p->readAt(pos, buf, len); // no walk from the start of the chain
+  if (!p->currentTrack.seek(pos))
+    return 0;
+  return p->currentTrack.read(buf, len);
+}
+
+void Adafruit_VS1053_FilePlayer::feedBuffer(void)
+{
+  FEEDER_IRQ_SAVE();
   noInterrupts();
+  // dont run twice in case interrupts collided, the running feeder takes
+  // the request over and runs once more before it releases the lock. Only
+  // an interrupt on top of a main loop feeder gets here, handlers don't nest.
+  if (feedBufferLock)
+  {
+    feedBufferPending = true;
+    feedCollisions++;
+    FEEDER_IRQ_RESTORE();
+    return;
+  }
+  feedBufferLock = true;
+  FEEDER_IRQ_RESTORE();
+#if VS1053_TELEMETRY
+  uint32_t start = micros();
+#endif
 
-  // As explained in datasheet, set twice 0 in REG_DECODETIME to set time back
-  // to 0
-  sciWrite(VS1053_REG_DECODETIME, 0x00);
-  sciWrite(VS1053_REG_DECODETIME, 0x00);
+  for (;;)
+  {
+    feedBuffer_noLock();
+    // test and release in one step, a request can't slip in between
+    noInterrupts();
+    if (!feedBufferPending)
+      break;
+    feedBufferPending = false;
+    feedReruns++;
+    FEEDER_IRQ_RESTORE();
+  }
+#if VS1053_TELEMETRY
+  _telemetry.countFeed(micros() - start);
+#endif
+  publishStatus();
+  feedBufferLock = false;
+  FEEDER_IRQ_RESTORE();
+}
+
+void Adafruit_VS1053_FilePlayer::feedBuffer_noLock(void)
+{
+  if ((!playingMusic) // paused or stopped
+      || (_startState == VS1053_START_ARMED) // decoder still busy with the previous file
+      || (!currentTrack) || (!readyForData()))
+  {
+    return; // paused or stopped
+  }
+
+  if (_useRing)
+  {
+    feedFromRing();
+    return;
+  }
+  if (_busHeld)
+  {
+    _telemetry.starved++;
+    return; // the main loop uses the card, endBusAccess() catches up
+  }
+
+  // Feed the hungry buffer! :)
+  uint8_t burst = 0;
+  while (readyForData())
+  {
+    if (seekPosition != -1){
+      currentTrack.seek(seekPosition);
+      _fedPosition = seekPosition;
+      seekPosition = -1;
+    }
+    
+    // Read some audio data from the SD card file
+    int bytesread = currentTrack.read(mp3buffer, VS1053_DATABUFFERLEN);
+
+    if (bytesread == 0)
+    {
+      // must be at the end of the file, the main loop drains the decoder
+      playingMusic = false;
+      _trackDone = true;
+      break;
+    }
+
+    playData(mp3buffer, bytesread);
+    _fedPosition += bytesread;
+    burst++;
+#if VS1053_TELEMETRY
+    _telemetry.fedBytes += bytesread;
+#endif
+    if (_startState == VS1053_START_FEEDING)
+      _startState = VS1053_START_PLAYING;
+  }
+  _burst = burst;
+}
+
+// consumer side of the ring with the runtime resolved pins
+void Adafruit_VS1053_FilePlayer::feedFromRing(void)
+{
+  feedRingWith(RuntimePins(*this));
+}
+
+void Adafruit_VS1053_FilePlayer::useRingBuffer(boolean enable)
+{
+  if (playingMusic)
+    return; // don't switch modes below a running stream
+  _useRing = enable;
+  _ring.reset();
+}
+
+// producer side of the ring, main loop only
+void Adafruit_VS1053_FilePlayer::feedRing(void)
+{
+  serviceRing();
+  updateStatus(); // changes of this pass, the feeder keeps state and position current
+}
+
+// producer side of the ring and the decoder housekeeping of feedRing()
+void Adafruit_VS1053_FilePlayer::serviceRing(void)
+{
+  if (_trackDone && currentTrack)
+  {
+    // last byte is in the decoder, end fill bytes push out its final frames
+    currentTrack.close();
+    loadEndFill();
+    enterEnd(VS1053_END_DRAIN);
+  }
+  if (_endState != VS1053_END_IDLE)
+    endStep();
+  if (_startState == VS1053_START_ARMED)
+    startStream();
+  else if (playingMusic && _startState == VS1053_START_PLAYING)
+  {
+    sampleTelemetry();
+    watchdog();
+  }
+
+  if (!_useRing || !currentTrack)
+    return;
+
+  if (seekPosition != -1)
+  {
+    if (playingMusic)
+    {
+      // the consumer drops the ring on its next run, wait for it
+      _ringDiscard = true;
+      feedBuffer();
+      if (_ringDiscard)
+        return;
+    }
+    else
+    {
+      _ring.reset();
+    }
+    seekRead(seekPosition);
+    _wdGoodPos = seekPosition;
+    uint32_t irqStart = irqOff();
+    _fedPosition = seekPosition;
+    irqOn(irqStart);
+    seekPosition = -1;
+    _ringEof = false;
+  }
+
+  while (!_ringEof && _ring.sectorFree())
+  {
+    uint32_t start = micros();
+    boolean raw = _rawBlock || _rawChain;
+    int bytesread = raw ? readRaw() : readFile();
+    if (bytesread <= 0)
+    {
+      if (_nextTrack)
+      {
+        // continue with the queued file in the same decode stream
+        _switchStart = micros();
+        _switchUnderruns = ringUnderruns;
+        currentTrack.close();
+        currentTrack = _nextTrack;
+        _nextTrack = File();
+        openRead(_nextRawBlock);
+        _seekInfoValid = false;
+        _wdGoodPos = 0;
+        // the ring still holds the rest of the previous file
+        uint32_t irqStart = irqOff();
+        _fedPosition = -(int32_t)_ring.bytes();
+        _gapWatch = true; // the feeder reports the switch with its first chunk
+        irqOn(irqStart);
+        _trackId++;
+        _switching = true;
+        continue;
+      }
+      _ringEof = true;
+      break;
+    }
+    countRead(raw ? &rawReads : &fileReads, bytesread, micros() - start);
+
+    if (_switching)
+    {
+      // first sector of the queued file is available to the feeder
+      lastSwitchMicros = micros() - _switchStart;
+      lastSwitchUnderruns = ringUnderruns - _switchUnderruns;
+      _switching = false;
+    }
+  }
+
+  // DREQ may have been high on an empty ring, there won't be another edge,
+  // the hybrid scheduler's tick takes care of that
+  if (playingMusic && _scheduler != VS1053_FILEPLAYER_HYBRID_INT)
+    feedBuffer();
+}
+
+// decoder side of the telemetry, once per VS1053_TELEMETRY_INTERVAL
+void Adafruit_VS1053_FilePlayer::sampleTelemetry(void)
+{
+  uint32_t now = millis();
+  uint32_t elapsed = now - _telemetry.sampleMillis;
+  if (elapsed < VS1053_TELEMETRY_INTERVAL)
+    return;
+
+  uint32_t start = irqOff();
+  uint32_t bytes = _telemetry.fedBytes;
+  uint32_t isr = _telemetry.isrMicros;
+  irqOn(start);
+  // bytes per ms * 8 is kbit/s, us per ms is permille
+  _telemetry.fedKbps = (bytes - _sampleBytes) * 8 / elapsed;
+  _sampleBytes = bytes;
+  _telemetry.isrPermille = (isr - _sampleIsr) / elapsed;
+  _sampleIsr = isr;
+
+  mp3FrameHeader h;
+  uint16_t hdat1 = sciRead(VS1053_REG_HDAT1);
+  _telemetry.bitrate = mp3ParseHdat(hdat1, sciRead(VS1053_REG_HDAT0), &h) ? h.bitrate : 0;
+  _telemetry.decodeTime = decodeTime();
+  _telemetry.speed = _speed;
+  _telemetry.sampleMillis = now;
+}
+
+// DECODETIME has to advance while the feeder has data for the decoder,
+// starving on a slow card is not the decoder's fault
+void Adafruit_VS1053_FilePlayer::watchdog(void)
+{
+  uint32_t now = millis();
+  if (now - _wdSample < VS1053_WATCHDOG_INTERVAL)
+    return;
+  // after a start, a pause or anything else that kept the samples away
+  boolean restart = (_wdSample == 0) || (now - _wdSample > 2 * VS1053_WATCHDOG_INTERVAL);
+  _wdSample = now;
+
+  uint32_t start = irqOff();
+  uint16_t starved = _telemetry.starved;
+  irqOn(start);
+  uint16_t t = decodeTime();
+  uint16_t hdat1 = sciRead(VS1053_REG_HDAT1);
+
+  if (restart || t != _wdDecodeTime || starved != _wdStarved)
+  {
+    // HDAT1 is 0 while the decoder has no valid frame header
+    if (!restart && t != _wdDecodeTime && hdat1)
+    {
+      _wdGoodPos = trackPosition();
+      _wdLevel = 0;
+    }
+    _wdDecodeTime = t;
+    _wdStarved = starved;
+    _wdProgress = now;
+  }
+  else if (now - _wdProgress >= VS1053_WATCHDOG_STALL)
+  {
+    recoverDecoder();
+  }
+}
+
+// every stall without progress in between goes one step further: cancel,
+// soft reset, hardware reset, then the track is given up. The stream restarts
+// where the decoder last advanced.
+void Adafruit_VS1053_FilePlayer::recoverDecoder(void)
+{
+  // keep the feeder away from the decoder
+  playingMusic = false;
+  _startState = VS1053_START_NONE;
+
+  switch (++_wdLevel)
+  {
+  case 1:
+    beginCancel(false); // endStep() falls back to a soft reset on its own
+    break;
+  case 2:
+    resetDecoder();
+    break;
+  case 3:
+  {
+    uint16_t volume = sciRead(VS1053_REG_VOLUME);
+    uint16_t clockf = _clockf;
+    _endState = VS1053_END_IDLE;
+    reset();
+    setClock(clockf ? clockf : VS1053_CLOCKF);
+    sciWrite(VS1053_REG_VOLUME, volume);
+    break;
+  }
+  default:
+    // the track doesn't decode, end it as if it was over
+    _wdLevel = 0;
+    _telemetry.stallSkips++;
+    _trackDone = true;
+    return;
+  }
+  _telemetry.recoveries++;
+  restartStream(_wdGoodPos);
+}
+
+// continue the current file at a byte position after a recovery. Unlike
+// startPlayingOpened() there is no resume rewind and the queued next file
+// stays. The start stays armed until endStep() is through with the cancel
+// or reset of the recovery.
+void Adafruit_VS1053_FilePlayer::restartStream(uint32_t position)
+{
+  seekRead(position);
+  seekPosition = -1;
+  _fedPosition = position; // the feeder is off, see recoverDecoder()
+  _trackDone = false;
+  if (_useRing)
+  {
+    _ring.reset();
+    _ringEof = false;
+    _ringDiscard = false;
+  }
+  // the next feedRing() starts it, after this one refilled the ring
+  _startState = VS1053_START_ARMED;
+  playingMusic = true;
+}
+
+// derived from the flags the feeder and the main loop change
+VS1053_PlayState Adafruit_VS1053_FilePlayer::playState(void)
+{
+  if (playingMusic)
+    return (_startState == VS1053_START_PLAYING) ? VS1053_STATE_PLAYING : VS1053_STATE_STARTING;
+  if (currentTrack && !_trackDone)
+    return VS1053_STATE_PAUSED;
+  if (currentTrack || _endState != VS1053_END_IDLE)
+    return VS1053_STATE_ENDING;
+  return VS1053_STATE_STOPPED;
+}
 
-  playingMusic = true;
-  seekPosition = -1;
+// the feeder's part of the status, it runs with the feeder lock held or
+// with interrupts off, so there is never more than one writer
+void Adafruit_VS1053_FilePlayer::publishStatus(void)
+{
+  _statusSeq++;
+  _status.state = playState();
+  _status.position = (_fedPosition > 0) ? _fedPosition : 0;
+  _statusSeq++;
+}
 
-  // wait till its ready for data
-  while (!readyForData())
-  {
-#if defined(ESP8266)
-    ESP.wdtFeed();
-#endif
-  }
+// the main loop's part, the fields only it changes plus the feeder's
+void Adafruit_VS1053_FilePlayer::updateStatus(void)
+{
+  uint32_t size = currentTrack ? currentTrack.size() : 0;
+  uint32_t start = irqOff();
+  _status.track = _trackId;
+  _status.size = size;
+  _status.decodeTime = _telemetry.decodeTime;
+  publishStatus();
+  irqOn(start);
+}
 
-  // fill it up!
-  while (playingMusic && readyForData())
+void Adafruit_VS1053_FilePlayer::status(VS1053_PlayerStatus *s)
+{
+  uint8_t seq;
+  do
   {
-    feedBuffer();
-  }
+    seq = _statusSeq;
+    // keep the compiler from moving the copy out of the two sequence reads
+    asm volatile("" ::: "memory");
+    *s = _status;
+    asm volatile("" ::: "memory");
+  } while ((seq & 1) || seq != _statusSeq);
+}
 
-  // ok going forward, we can use the IRQ
-  interrupts();
+void Adafruit_VS1053_FilePlayer::telemetry(VS1053_Telemetry *t)
+{
+  uint32_t start = irqOff();
+  *t = _telemetry;
+  irqOn(start);
+}
 
-  return true;
+// one sector through SdFat, commits it to the ring
+int Adafruit_VS1053_FilePlayer::readFile(void)
+{
+  // first read after open or seek realigns the file to the SD sectors
+  uint16_t len = AUDIORING_SECTORLEN -
+                 (currentTrack.position() % AUDIORING_SECTORLEN);
+  int bytesread = currentTrack.read(_ring.sectorBuffer(), len);
+  if (bytesread > 0)
+    _ring.commitSector(bytesread);
+  return bytesread;
 }
 
-boolean Adafruit_VS1053_FilePlayer::startPlayingFile(const char *trackname, uint32_t position)
+// sectors straight from the card, no SdFat file layer or cache, as many
+// as fit into the ring in one piece and lie in one cluster, commits them to the ring
+int Adafruit_VS1053_FilePlayer::readRaw(void)
 {
-  // reset playback
-  sciWrite(VS1053_REG_MODE, VS1053_MODE_SM_LINE1 | VS1053_MODE_SM_SDINEW |
-                                VS1053_MODE_SM_LAYER12);
-  // resync
-  sciWrite(VS1053_REG_WRAMADDR, 0x1e29);
-  sciWrite(VS1053_REG_WRAM, 0);
+  uint32_t size = currentTrack.size();
+  if (_rawPos >= size)
+    return 0;
 
-  currentTrack = SD.open(trackname);
-  if (!currentTrack)
+  uint16_t offset = _rawPos % AUDIORING_SECTORLEN;
+  uint32_t blocks = (size - _rawPos + offset + AUDIORING_SECTORLEN - 1) / AUDIORING_SECTORLEN;
+  if (_rawChain)
   {
-    return false;
+    uint32_t inCluster = (_clusterBytes - _rawPos % _clusterBytes + offset) / AUDIORING_SECTORLEN;
+    if (blocks > inCluster)
+      blocks = inCluster;
   }
-
-  // We know we have a valid file. Check if .mp3
-  // If so, go to specified file position
-  if (position != 0)
+  uint8_t n = offset ? 1 : _ring.sectorsFreeLinear(); // realign with a single sector first
+  if (n > blocks)
+    n = blocks;
+  uint8_t *buffer = _ring.sectorBuffer();
+  uint32_t block;
+  if (!blockAt(_rawPos, &block) || !SD.card()->readBlocks(block, buffer, n))
   {
-    currentTrack.seek(position); // jump to given position
+    // card error or broken chain, let SdFat retry and go on through the file
+    _rawBlock = 0;
+    _rawChain = false;
+    currentTrack.seek(_rawPos);
+    return readFile();
   }
-  else
+
+  int bytesread = 0;
+  for (uint8_t i = 0; i < n; i++)
   {
-    // if .mp3, check for ID3 tag and jump it if present.
-    if (isMP3File(trackname))
-    {
-      currentTrack.seek(mp3_ID3Jumper(currentTrack));
-    }
+    uint16_t len = AUDIORING_SECTORLEN - offset;
+    if (len > size - _rawPos)
+      len = size - _rawPos;
+    if (offset)
+      memmove(buffer, buffer + offset, len); // sector buffers start a ring sector
+    _ring.commitSector(len);
+    buffer += AUDIORING_SECTORLEN;
+    _rawPos += len;
+    bytesread += len;
+    offset = 0;
   }
-  // don't let the IRQ get triggered by accident here
-  noInterrupts();
-
-  // As explained in datasheet, set twice 0 in REG_DECODETIME to set time back
-  // to 0
-  sciWrite(VS1053_REG_DECODETIME, 0x00);
-  sciWrite(VS1053_REG_DECODETIME, 0x00);
+  return bytesread;
+}
 
-  playingMusic = true;
+static bool fatNext(void *volume, uint32_t cluster, uint32_t *next)
+{
+  return ((FatVolume *)volume)->dbgFat(cluster, next) > 0;
+}
 
-  // wait till its ready for data
-  while (!readyForData())
+// choose how the producer reads a newly opened currentTrack
+void Adafruit_VS1053_FilePlayer::openRead(uint32_t contiguousBlock)
+{
+  _rawPos = currentTrack.position();
+  _rawBlock = _useRing ? contiguousBlock : 0; // without the ring the interrupt reads the file
+  _rawChain = false;
+#if VS1053_CLUSTERCACHE
+  if (_useRing && !_rawBlock && currentTrack.firstCluster())
   {
-#if defined(ESP8266)
-    ESP.wdtFeed();
-#endif
+    FatVolume *volume = currentTrack.volume();
+    _clusterBytes = (uint32_t)volume->blocksPerCluster() * AUDIORING_SECTORLEN;
+    _clusters.reset(currentTrack.firstCluster(),
+                    (currentTrack.size() + _clusterBytes - 1) / _clusterBytes);
+    _rawChain = true;
   }
+#endif
+}
 
-  // fill it up!
-  while (playingMusic && readyForData())
+// card block holding a file position of a raw read track
+boolean Adafruit_VS1053_FilePlayer::blockAt(uint32_t position, uint32_t *block)
+{
+  if (_rawBlock)
   {
-    feedBuffer();
+    *block = _rawBlock + position / AUDIORING_SECTORLEN;
+    return true;
   }
-
-  // ok going forward, we can use the IRQ
-  interrupts();
-
+  FatVolume *volume = currentTrack.volume();
+  uint32_t cluster;
+  if (!_clusters.locate(position / _clusterBytes, fatNext, volume, &cluster))
+    return false;
+  *block = volume->dataStartBlock() + (cluster - 2) * volume->blocksPerCluster() +
+           (position % _clusterBytes) / AUDIORING_SECTORLEN;
   return true;
 }
 
-long Adafruit_VS1053_FilePlayer::fileSize(void)
+// bytes of a raw read track for the frame parser, uses the SdFat cache
+// buffer as scratch since a sector of RAM is not to be had otherwise
+int Adafruit_VS1053_FilePlayer::readAt(uint32_t position, uint8_t *buf, uint16_t len)
 {
-  if (playingMusic)
-  {
-    return currentTrack.size();
-  }
-  else
+  uint32_t size = currentTrack.size();
+  if (position >= size)
+    return 0;
+  if (len > size - position)
+    len = size - position;
+
+  uint16_t done = 0;
+  while (done < len)
   {
-    return -1;
+    uint32_t block;
+    uint32_t lookups = _clusters.lookups;
+    if (!blockAt(position + done, &block))
+      break;
+    if (_clusters.lookups != lookups)
+      _scratchBlock = 0; // FAT reads go through the same buffer
+    cache_t *scratch = SD.vol()->cacheClear();
+    if (!scratch)
+      break;
+    if (block != _scratchBlock)
+    {
+      _scratchBlock = 0;
+      if (!SD.card()->readBlock(block, scratch->data))
+        break;
+      _scratchBlock = block;
+    }
+    uint16_t offset = (position + done) % AUDIORING_SECTORLEN;
+    uint16_t part = AUDIORING_SECTORLEN - offset;
+    if (part > len - done)
+      part = len - done;
+    memcpy(buf + done, scratch->data + offset, part);
+    done += part;
   }
+  return done;
 }
 
-long Adafruit_VS1053_FilePlayer::filePosition(void)
+// move the producer, plain arithmetic for raw read files
+void Adafruit_VS1053_FilePlayer::seekRead(uint32_t position)
 {
-  if (playingMusic)
-  {
-    return currentTrack.position();
-  }
+  if (_rawBlock || _rawChain)
+    _rawPos = position; // the chain is resolved by the next read
   else
+    currentTrack.seek(position);
+}
+
+// next byte the producer reads
+uint32_t Adafruit_VS1053_FilePlayer::readPosition(void)
+{
+  return (_rawBlock || _rawChain) ? _rawPos : currentTrack.position();
+}
+
+// position of the next byte going to the decoder
+uint32_t Adafruit_VS1053_FilePlayer::trackPosition(void)
+{
+  uint32_t position = readPosition();
+  if (_useRing)
   {
-    return -1;
+    // right after a queued switch the ring still holds the previous file
+    uint16_t buffered = _ring.bytes();
+    position = (position > buffered) ? position - buffered : 0;
   }
+  return position;
 }
 
-void Adafruit_VS1053_FilePlayer::fileSeek(long position)
+void Adafruit_VS1053_FilePlayer::beginBusAccess(void)
 {
-  if (playingMusic) {
-    seekPosition = position;
-  }
+  if (_busHeld++ == 0)
+    _busUnderrunStart = ringUnderruns;
+  // audio first: as much as possible in the ring before the card is busy
+  feedRing();
 }
 
-void Adafruit_VS1053_FilePlayer::feedBuffer(void)
+void Adafruit_VS1053_FilePlayer::endBusAccess(void)
 {
-  noInterrupts();
-  // dont run twice in case interrupts collided
-  // This isn't a perfect lock as it may lose one feedBuffer request if
-  // an interrupt occurs before feedBufferLock is reset to false. This
-  // may cause a glitch in the audio but at least it will not corrupt
-  // state.
-  if (feedBufferLock)
-  {
-    interrupts();
+  if (_busHeld == 0)
     return;
+  if (--_busHeld == 0)
+  {
+    busAccesses++;
+    busUnderruns += ringUnderruns - _busUnderrunStart;
   }
-  feedBufferLock = true;
-  interrupts();
+  feedRing();
+  // DREQ edges during the access may have found nothing to do
+  if (playingMusic)
+    feedBuffer();
+}
 
-  feedBuffer_noLock();
+boolean Adafruit_VS1053_FilePlayer::queueNextFile(const char *trackname, uint32_t audioStart)
+{
+  if (!_useRing || !currentTrack)
+    return false; // the queue is served by feedRing()
 
-  feedBufferLock = false;
+  _nextTrack.close();
+  _nextTrack = SD.open(trackname);
+  if (!_nextTrack)
+    return false;
+  if (audioStart != VS1053_AUDIOSTART_PROBE)
+    _nextTrack.seek(audioStart);
+  else if (isMP3File(trackname))
+    _nextTrack.seek(mp3_ID3Jumper(_nextTrack));
+  _nextRawBlock = contiguousStart(&_nextTrack);
+  return true;
 }
 
-void Adafruit_VS1053_FilePlayer::feedBuffer_noLock(void)
+boolean Adafruit_VS1053_FilePlayer::queueNextEntry(FatFile *dir, uint16_t entryIndex,
+                                                   uint32_t audioStart)
 {
-  if ((!playingMusic) // paused or stopped
-      || (!currentTrack) || (!readyForData()))
-  {
-    return; // paused or stopped
-  }
+  if (!_useRing || !currentTrack)
+    return false; // the queue is served by feedRing()
 
-  // Feed the hungry buffer! :)
-  while (readyForData())
-  {
-    if (seekPosition != -1){
-      currentTrack.seek(seekPosition);
-      seekPosition = -1;
-    }
-    
-    // Read some audio data from the SD card file
-    int bytesread = currentTrack.read(mp3buffer, VS1053_DATABUFFERLEN);
+  _nextTrack.close();
+  if (!_nextTrack.open(dir, entryIndex, O_READ))
+    return false;
+  if (audioStart != VS1053_AUDIOSTART_PROBE)
+    _nextTrack.seek(audioStart);
+  else
+    _nextTrack.seek(mp3_ID3Jumper(_nextTrack));
+  _nextRawBlock = contiguousStart(&_nextTrack);
+  return true;
+}
 
-    if (bytesread == 0)
-    {
-      // must be at the end of the file, wrap it up!
-      playingMusic = false;
-      currentTrack.close();
-      break;
-    }
+boolean Adafruit_VS1053_FilePlayer::nextQueued(void)
+{
+  return _nextTrack;
+}
 
-    playData(mp3buffer, bytesread);
-  }
+boolean Adafruit_VS1053_FilePlayer::queuedTrackStarted(void)
+{
+  boolean started = _queuedStarted;
+  _queuedStarted = false;
+  return started;
 }
 
 /***************************************************************/
@@ -500,7 +1441,7 @@ Adafruit_VS1053::Adafruit_VS1053(int8_t rst, int8_t cs, int8_t dcs,
   _dreq = dreq;
 }
 
-void Adafruit_VS1053::applyPatch(const uint16_t *patch, uint16_t patchsize)
+boolean Adafruit_VS1053::applyPatch(const uint16_t *patch, uint16_t patchsize)
 {
   uint16_t i = 0;
 
@@ -514,29 +1455,58 @@ void Adafruit_VS1053::applyPatch(const uint16_t *patch, uint16_t patchsize)
     i += 2;
 
     // Serial.println(addr, HEX);
+    // each run goes to a single register, one transaction per run
+    sciWriteBegin(addr);
+    boolean ok = true;
     if (n & 0x8000U)
     { // RLE run, replicate n samples
       n &= 0x7FFF;
       val = pgm_read_word(patch++);
       i++;
-      while (n--)
+      while (n-- && ok)
       {
-        sciWrite(addr, val);
+        ok = sciWriteWord(val);
       }
     }
     else
     { // Copy run, copy n samples
-      while (n--)
+      while (n-- && ok)
       {
         val = pgm_read_word(patch++);
         i++;
-        sciWrite(addr, val);
+        ok = sciWriteWord(val);
       }
     }
+    sciWriteEnd();
+    if (!ok)
+      return false; // decoder stuck, don't hold the bus for the rest
   }
+  return true;
 }
 
-uint16_t Adafruit_VS1053::loadPlugin(char *plugname)
+// plugin file read in blocks instead of byte by byte
+struct PluginReader
+{
+  File *file;
+  uint16_t pos, len;
+  uint8_t buf[VS1053_PLUGINBUFLEN];
+
+  // next byte, -1 at the end
+  int read(void)
+  {
+    if (pos == len)
+    {
+      int n = file->read(buf, VS1053_PLUGINBUFLEN);
+      if (n <= 0)
+        return -1;
+      len = n;
+      pos = 0;
+    }
+    return buf[pos++];
+  }
+};
+
+uint16_t Adafruit_VS1053::loadPlugin(const char *plugname)
 {
   File plugin = SD.open(plugname);
   if (!plugin)
@@ -546,17 +1516,24 @@ uint16_t Adafruit_VS1053::loadPlugin(char *plugname)
     return 0xFFFF;
   }
 
-  if ((plugin.read() != 'P') || (plugin.read() != '&') ||
-      (plugin.read() != 'H'))
+  PluginReader reader;
+  reader.file = &plugin;
+  reader.pos = reader.len = 0;
+
+  if ((reader.read() != 'P') || (reader.read() != '&') ||
+      (reader.read() != 'H'))
+  {
+    plugin.close();
     return 0xFFFF;
+  }
 
   uint16_t type;
 
   // Serial.print("Patch size: "); Serial.println(patchsize);
-  while ((type = plugin.read()) >= 0)
+  while ((type = reader.read()) >= 0)
   {
     uint16_t offsets[] = {0x8000UL, 0x0, 0x4000UL};
-    uint16_t addr, len;
+    uint16_t addr, n;
 
     // Serial.print("type: "); Serial.println(type, HEX);
 
@@ -566,13 +1543,13 @@ uint16_t Adafruit_VS1053::loadPlugin(char *plugname)
       return 0xFFFF;
     }
 
-    len = plugin.read();
-    len <<= 8;
-    len |= plugin.read() & ~1;
-    addr = plugin.read();
+    n = reader.read();
+    n <<= 8;
+    n |= reader.read() & ~1;
+    addr = reader.read();
     addr <<= 8;
-    addr |= plugin.read();
-    // Serial.print("len: "); Serial.print(len);
+    addr |= reader.read();
+    // Serial.print("len: "); Serial.print(n);
     // Serial.print(" addr: $"); Serial.println(addr, HEX);
 
     if (type == 3)
@@ -584,40 +1561,144 @@ uint16_t Adafruit_VS1053::loadPlugin(char *plugname)
 
     // set address
     sciWrite(VS1053_REG_WRAMADDR, addr + offsets[type]);
-    // write data
-    do
+    // write data, WRAMADDR advances with every word
+    sciWriteBegin(VS1053_REG_WRAM);
+    boolean ok = true;
+    for (; n && ok; n -= 2)
     {
       uint16_t data;
-      data = plugin.read();
+      data = reader.read();
       data <<= 8;
-      data |= plugin.read();
-      sciWrite(VS1053_REG_WRAM, data);
-    } while ((len -= 2));
+      data |= reader.read();
+      ok = sciWriteWord(data);
+    }
+    sciWriteEnd();
+    if (!ok)
+    {
+      // decoder stuck, stop the upload
+      plugin.close();
+      return 0xFFFF;
+    }
   }
 
   plugin.close();
   return 0xFFFF;
 }
 
-boolean Adafruit_VS1053::readyForData(void) { return digitalRead(_dreq); }
+boolean Adafruit_VS1053::startPatches(const char *fn)
+{
+  _patchFile = fn;
+  return reloadPatches();
+}
+
+boolean Adafruit_VS1053::patchesActive(void) { return _patchesActive; }
+
+boolean Adafruit_VS1053::reloadPatches(void)
+{
+  _patchesActive = false;
+  uint16_t addr = loadPlugin(_patchFile);
+  if (addr == 0xFFFF)
+    return false;
+  // loadPlugin() stops at the execute record, this starts the code
+  sciWrite(VS1053_SCI_AIADDR, addr);
+  _patchesActive = true;
+  return true;
+}
+
+boolean Adafruit_VS1053::readyForData(void) { return (*_dreqPort & _dreqMask) != 0; }
 
 void Adafruit_VS1053::playData(uint8_t *buffer, uint8_t buffsiz)
+{
+  sdiBegin();
+  spiwrite(buffer, buffsiz);
+  sdiEnd();
+}
+
+// The chip select toggles below are plain read-modify-writes on the port.
+// They are safe against the feeder interrupt because every user restores the
+// pin before returning, so an interrupted access writes back the same value.
+void Adafruit_VS1053::sdiBegin(void)
+{
+  spiDataBegin();
+  *_dcsPort &= ~_dcsMask;
+}
+
+void Adafruit_VS1053::sdiEnd(void)
+{
+  *_dcsPort |= _dcsMask;
+  spiDataEnd();
+}
+
+void Adafruit_VS1053::spiDataBegin(void)
 {
 #ifdef SPI_HAS_TRANSACTION
   if (useHardwareSPI)
     SPI.beginTransaction(VS1053_DATA_SPI_SETTING);
 #endif
-  digitalWrite(_dcs, LOW);
-
-  spiwrite(buffer, buffsiz);
+}
 
-  digitalWrite(_dcs, HIGH);
+void Adafruit_VS1053::spiDataEnd(void)
+{
 #ifdef SPI_HAS_TRANSACTION
   if (useHardwareSPI)
     SPI.endTransaction();
 #endif
 }
 
+void Adafruit_VS1053::benchmarkSDI(void)
+{
+  const uint16_t chunks = 64;
+  uint32_t legacy = 0, bulk = 0;
+
+  // stream zeros, the decoder skips them like end fill bytes
+  memset(mp3buffer, 0, VS1053_DATABUFFERLEN);
+  for (uint16_t i = 0; i < chunks; i++)
+  {
+    while (!readyForData())
+      ;
+    uint32_t t = micros();
+    // byte wise path as used before: digitalWrite and one transfer per byte
+#ifdef SPI_HAS_TRANSACTION
+    if (useHardwareSPI)
+      SPI.beginTransaction(VS1053_DATA_SPI_SETTING);
+#endif
+    digitalWrite(_dcs, LOW);
+    for (uint8_t b = 0; b < VS1053_DATABUFFERLEN; b++)
+      SPI.transfer(mp3buffer[b]);
+    digitalWrite(_dcs, HIGH);
+#ifdef SPI_HAS_TRANSACTION
+    if (useHardwareSPI)
+      SPI.endTransaction();
+#endif
+    legacy += micros() - t;
+
+    while (!readyForData())
+      ;
+    t = micros();
+    playData(mp3buffer, VS1053_DATABUFFERLEN);
+    bulk += micros() - t;
+  }
+
+  // cycles per 32 byte chunk and the CPU share needed to feed a stream
+  legacy = legacy * clockCyclesPerMicrosecond() / chunks;
+  bulk = bulk * clockCyclesPerMicrosecond() / chunks;
+  Serial.print(F("SDI cycles/chunk legacy: "));
+  Serial.print(legacy);
+  Serial.print(F(" bulk: "));
+  Serial.println(bulk);
+  const uint16_t kbps[] = {128, 320};
+  for (uint8_t i = 0; i < 2; i++)
+  {
+    // chunks per second * cycles per chunk / cycles per second, in 0.1%
+    uint32_t chunksPerSec = kbps[i] * 1000UL / 8 / VS1053_DATABUFFERLEN;
+    Serial.print(kbps[i]);
+    Serial.print(F(" kbps CPU permille legacy: "));
+    Serial.print(chunksPerSec * legacy / (F_CPU / 1000));
+    Serial.print(F(" bulk: "));
+    Serial.println(chunksPerSec * bulk / (F_CPU / 1000));
+  }
+}
+
 void Adafruit_VS1053::setVolume(uint8_t left, uint8_t right)
 {
   // accepts values between 0 and 255 for left and right.
@@ -626,23 +1707,133 @@ void Adafruit_VS1053::setVolume(uint8_t left, uint8_t right)
   v <<= 8;
   v |= right;
 
-  noInterrupts(); // cli();
+  uint32_t start = irqOff();
   sciWrite(VS1053_REG_VOLUME, v);
-  interrupts(); // sei();
+  irqOn(start);
 }
 
 uint16_t Adafruit_VS1053::decodeTime()
 {
-  noInterrupts(); // cli();
+  uint32_t start = irqOff();
   uint16_t t = sciRead(VS1053_REG_DECODETIME);
-  interrupts(); // sei();
+  irqOn(start);
   return t;
 }
 
 void Adafruit_VS1053::softReset(void)
 {
   sciWrite(VS1053_REG_MODE, VS1053_MODE_SM_SDINEW | VS1053_MODE_SM_RESET);
+  sciSafeClock();
+  _patchesActive = false;
   delay(100);
+  if (_clockf)
+    setClock(_clockf);
+  if (_patchFile)
+    reloadPatches();
+  if (_speed != 100)
+    applySpeed();
+}
+
+void Adafruit_VS1053::setClock(uint16_t clockf)
+{
+  sciSafeClock();
+  sciWrite(VS1053_REG_CLOCKF, clockf);
+  // the clock settles while DREQ is low, don't hang on a stuck decoder
+  delayMicroseconds(100);
+  uint32_t start = millis();
+  while (!readyForData() && millis() - start < 10)
+    ;
+
+  // CLKI = XTALI * SC_MULT, in halves: 1.0x, 2.0x, 2.5x ... 5.0x
+  static const uint8_t mult2[8] = {2, 4, 5, 6, 7, 8, 9, 10};
+  uint32_t clki = VS1053_XTALI / 2 * mult2[clockf >> 13];
+  _clockf = clockf;
+  _sciClock = clki / 7;
+  _sciSetting = SPISettings(_sciClock, MSBFIRST, SPI_MODE0);
+}
+
+void Adafruit_VS1053::sciSafeClock(void)
+{
+  _sciClock = 250000;
+  _sciSetting = VS1053_CONTROL_SPI_SETTING;
+}
+
+uint32_t Adafruit_VS1053::sciClock(void) { return _sciClock; }
+
+uint16_t Adafruit_VS1053::paraRead(uint16_t addr)
+{
+  uint32_t start = irqOff();
+  sciWrite(VS1053_REG_WRAMADDR, addr);
+  uint16_t data = sciRead(VS1053_REG_WRAM);
+  irqOn(start);
+  return data;
+}
+
+void Adafruit_VS1053::paraWrite(uint16_t addr, uint16_t data)
+{
+  uint32_t start = irqOff();
+  sciWrite(VS1053_REG_WRAMADDR, addr);
+  sciWrite(VS1053_REG_WRAM, data);
+  irqOn(start);
+}
+
+uint16_t Adafruit_VS1053::setPlaySpeed(uint16_t percent)
+{
+  if (percent < VS1053_SPEED_MIN)
+    percent = VS1053_SPEED_MIN;
+  if (percent > VS1053_SPEED_MAX)
+    percent = VS1053_SPEED_MAX;
+  if (!_patchesActive)
+    percent = 100; // nothing runs that would read the speed variables
+  _speed = percent;
+  applySpeed();
+  return _speed;
+}
+
+uint16_t Adafruit_VS1053::playSpeed(void) { return _speed; }
+
+void Adafruit_VS1053::applySpeed(void)
+{
+  if (!_patchesActive)
+    return;
+  // the shifter covers 0.68x to 1.64x, frame skipping doubles that
+  uint8_t skip = (_speed > 164) ? 2 : 1;
+  paraWrite(VS1053_PARA_PLAYSPEED, skip);
+  paraWrite(VS1053_PARA_SPEEDSHIFTER, (uint32_t)_speed * 16384 / 100 / skip);
+}
+
+void Adafruit_VS1053::benchmarkSCI(void)
+{
+  const uint16_t n = 200;
+  SPISettings fast = _sciSetting;
+  uint32_t fastClock = _sciClock;
+  uint16_t volume = sciRead(VS1053_REG_VOLUME);
+
+  for (uint8_t profile = 0; profile < 2; profile++)
+  {
+    if (profile == 0)
+      sciSafeClock();
+    else
+    {
+      _sciSetting = fast;
+      _sciClock = fastClock;
+    }
+    uint32_t t = micros();
+    for (uint16_t i = 0; i < n; i++)
+      sciRead(VS1053_REG_STATUS);
+    uint32_t read = micros() - t;
+    t = micros();
+    for (uint16_t i = 0; i < n; i++)
+      sciWrite(VS1053_REG_VOLUME, volume);
+    uint32_t write = micros() - t;
+
+    Serial.print(F("SCI kHz: "));
+    Serial.print(_sciClock / 1000);
+    Serial.print(F(" read ns: "));
+    Serial.print(read * 1000UL / n);
+    Serial.print(F(" write ns: "));
+    Serial.println(write * 1000UL / n);
+  }
 }
 
 void Adafruit_VS1053::reset()
@@ -662,7 +1853,7 @@ void Adafruit_VS1053::reset()
   softReset();
   delay(100);
 
-  sciWrite(VS1053_REG_CLOCKF, 0x6000);
+  setClock(VS1053_CLOCKF);
 
   setVolume(40, 40);
 }
@@ -681,6 +1872,14 @@ uint8_t Adafruit_VS1053::begin(void)
   digitalWrite(_dcs, HIGH);
   pinMode(_dreq, INPUT);
 
+  // resolve ports once, hot paths toggle the registers directly
+  _csPort = portOutputRegister(digitalPinToPort(_cs));
+  _csMask = digitalPinToBitMask(_cs);
+  _dcsPort = portOutputRegister(digitalPinToPort(_dcs));
+  _dcsMask = digitalPinToBitMask(_dcs);
+  _dreqPort = portInputRegister(digitalPinToPort(_dreq));
+  _dreqMask = digitalPinToBitMask(_dreq);
+
   if (!useHardwareSPI)
   {
     pinMode(_mosi, OUTPUT);
@@ -726,10 +1925,7 @@ uint16_t Adafruit_VS1053::recordedReadWord(void)
 
 boolean Adafruit_VS1053::prepareRecordOgg(char *plugname)
 {
-  sciWrite(VS1053_REG_CLOCKF, 0xC000); // set max clock
-  delay(1);
-  while (!readyForData())
-    ;
+  setClock(VS1053_CLOCKF_4_5X); // set max clock
 
   sciWrite(VS1053_REG_BASS, 0); // clear Bass
 
@@ -842,16 +2038,16 @@ uint16_t Adafruit_VS1053::sciRead(uint8_t addr)
 
 #ifdef SPI_HAS_TRANSACTION
   if (useHardwareSPI)
-    SPI.beginTransaction(VS1053_CONTROL_SPI_SETTING);
+    SPI.beginTransaction(_sciSetting);
 #endif
-  digitalWrite(_cs, LOW);
+  *_csPort &= ~_csMask;
   spiwrite(VS1053_SCI_READ);
   spiwrite(addr);
   delayMicroseconds(10);
   data = spiread();
   data <<= 8;
   data |= spiread();
-  digitalWrite(_cs, HIGH);
+  *_csPort |= _csMask;
 #ifdef SPI_HAS_TRANSACTION
   if (useHardwareSPI)
     SPI.endTransaction();
@@ -860,18 +2056,54 @@ uint16_t Adafruit_VS1053::sciRead(uint8_t addr)
   return data;
 }
 
+void Adafruit_VS1053::sciWriteBegin(uint8_t addr)
+{
+#ifdef SPI_HAS_TRANSACTION
+  if (useHardwareSPI)
+    SPI.beginTransaction(_sciSetting);
+#endif
+  *_csPort &= ~_csMask;
+  spiwrite(VS1053_SCI_WRITE);
+  spiwrite(addr);
+}
+
+boolean Adafruit_VS1053::sciWriteWord(uint16_t data)
+{
+  // DREQ is low while the previous word executes, a stalled decoder must
+  // not keep the bus
+  if (!readyForData())
+  {
+    uint32_t start = millis();
+    while (!readyForData())
+      if (millis() - start >= VS1053_SCI_TIMEOUT)
+        return false;
+  }
+  uint8_t word[2] = {(uint8_t)(data >> 8), (uint8_t)data};
+  spiwrite(word, 2);
+  return true;
+}
+
+void Adafruit_VS1053::sciWriteEnd(void)
+{
+  *_csPort |= _csMask;
+#ifdef SPI_HAS_TRANSACTION
+  if (useHardwareSPI)
+    SPI.endTransaction();
+#endif
+}
+
 void Adafruit_VS1053::sciWrite(uint8_t addr, uint16_t data)
 {
 #ifdef SPI_HAS_TRANSACTION
   if (useHardwareSPI)
-    SPI.beginTransaction(VS1053_CONTROL_SPI_SETTING);
+    SPI.beginTransaction(_sciSetting);
 #endif
-  digitalWrite(_cs, LOW);
+  *_csPort &= ~_csMask;
   spiwrite(VS1053_SCI_WRITE);
   spiwrite(addr);
   spiwrite(data >> 8);
   spiwrite(data & 0xFF);
-  digitalWrite(_cs, HIGH);
+  *_csPort |= _csMask;
 #ifdef SPI_HAS_TRANSACTION
   if (useHardwareSPI)
     SPI.endTransaction();
@@ -926,6 +2158,23 @@ void Adafruit_VS1053::spiwrite(uint8_t *c, uint16_t num)
     //  return;
     //#endif
 
+#if defined(ARDUINO_ARCH_AVR)
+    // pipelined: fetch the next byte while the previous one shifts out
+    if (!num)
+      return;
+    SPDR = *c++;
+    while (--num)
+    {
+      uint8_t out = *c++;
+      while (!(SPSR & _BV(SPIF)))
+        ;
+      SPDR = out;
+    }
+    while (!(SPSR & _BV(SPIF)))
+      ;
+    return;
+#endif
+
     while (num--)
     {
       SPI.transfer(c[0]);
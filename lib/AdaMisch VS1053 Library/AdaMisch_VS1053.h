@@ -26,6 +26,11 @@ extern SdFat SD;
 #include <SD.h>
 #endif
 
+#include "AdaMisch_AudioRing.h"
+#include "AdaMisch_ClusterCache.h"
+#include "AdaMisch_Telemetry.h"
+#include <mp3Frame.h>
+
 // define here the size of a register!
 #if defined(ARDUINO_STM32_FEATHER)
 typedef volatile uint32 RwReg;
@@ -60,6 +65,39 @@ typedef volatile RwReg PortReg; //!< Type definition/alias used to specify the
   255 //!< Allows useInterrupt to accept pins 0 to 254
 #define VS1053_FILEPLAYER_PIN_INT \
   5 //!< Allows useInterrupt to accept pins 0 to 4
+#define VS1053_FILEPLAYER_HYBRID_INT \
+  6 //!< rising DREQ edge, a slow TIMER0 tick recovers missed edges (AVR only)
+
+#ifndef VS1053_HYBRID_TICK
+#define VS1053_HYBRID_TICK 8 //!< TIMER0 compares, about 1 ms each, per hybrid scheduler tick
+#endif
+#ifndef VS1053_HYBRID_MINBURST
+#define VS1053_HYBRID_MINBURST 4 //!< chunks below which an edge run leaves the next edges to the tick
+#endif
+
+#define VS1053_AUDIOSTART_PROBE \
+  0xFFFFFFFF //!< start offset unknown, probe the file for an ID3 tag
+
+#define VS1053_PARA_PLAYSPEED 0x1E04    //!< WRAM address of playSpeed, 2 decodes two frames per frame played
+#define VS1053_PARA_ENDFILLBYTE 0x1E06 //!< WRAM address of the end fill byte parameter
+#define VS1053_PARA_SPEEDSHIFTER 0x1E1D //!< WRAM address of the speed shifter of the patches package, 16384 is 1.0
+#define VS1053_SPEED_MIN 68  //!< slowest play speed in percent, limit of the speed shifter
+#define VS1053_SPEED_MAX 300 //!< fastest, playSpeed 2 times a shifter of 1.5
+#define VS1053_ENDFILL_BYTES 2052      //!< end fill bytes that flush the decoder
+#define VS1053_CANCEL_BYTES 2048       //!< fill bytes after SM_CANCEL before a soft reset
+
+#ifndef VS1053_CANCEL_TIMEOUT
+#define VS1053_CANCEL_TIMEOUT 100 //!< ms for cancel, flush or reset before the next fallback
+#endif
+#ifndef VS1053_DRAIN_TIMEOUT
+#define VS1053_DRAIN_TIMEOUT 1000 //!< ms the decoder may play out the end of a file without progress
+#endif
+#ifndef VS1053_WATCHDOG_INTERVAL
+#define VS1053_WATCHDOG_INTERVAL 500 //!< ms between two watchdog samples of DECODETIME and HDAT1
+#endif
+#ifndef VS1053_WATCHDOG_STALL
+#define VS1053_WATCHDOG_STALL 3000 //!< ms without decoder progress before the watchdog steps in
+#endif
 
 #define VS1053_SCI_READ 0x03  //!< Serial read address
 #define VS1053_SCI_WRITE 0x02 //!< Serial write address
@@ -103,6 +141,29 @@ typedef volatile RwReg PortReg; //!< Type definition/alias used to specify the
 
 #define VS1053_DATABUFFERLEN 32 //!< Length of the data buffer
 
+#ifndef VS1053_PLUGINBUFLEN
+#define VS1053_PLUGINBUFLEN 512 //!< loadPlugin() reads the file in blocks of this size, on the stack
+#endif
+#ifndef VS1053_SCI_TIMEOUT
+#define VS1053_SCI_TIMEOUT 10   //!< ms sciWriteWord() waits for DREQ before it gives up
+#endif
+
+#define VS1053_CONTROL_SPI_SETTING \
+  SPISettings(250000, MSBFIRST, SPI_MODE0) //!< VS1053 SPI control settings
+                                           //!< before CLOCKF is set
+
+#define VS1053_XTALI 12288000UL   //!< crystal frequency, SC_FREQ 0
+#define VS1053_CLOCKF_3X 0x6000   //!< SC_MULT 3.0x, enough for MP3
+#define VS1053_CLOCKF_3_5X 0x8000 //!< SC_MULT 3.5x
+#define VS1053_CLOCKF_4X 0xA000   //!< SC_MULT 4.0x, headroom for FLAC or high bitrates
+#define VS1053_CLOCKF_4_5X 0xC000 //!< SC_MULT 4.5x, the maximum, e.g. for Ogg recording
+
+#ifndef VS1053_CLOCKF
+#define VS1053_CLOCKF VS1053_CLOCKF_3X //!< CLOCKF written by reset()
+#endif
+#define VS1053_DATA_SPI_SETTING \
+  SPISettings(8000000, MSBFIRST, SPI_MODE0) //!< VS1053 SPI data settings
+
 /*!
  * Driver for the Adafruit VS1053
  */
@@ -147,13 +208,32 @@ public:
    * @param addr Register address to read from
    * @return Retuns the 16-bit data corresponding to the received address
    */
-  uint16_t sciRead(uint8_t addr);
+  virtual uint16_t sciRead(uint8_t addr);
   /*!
    * @brief Writes to the specified register on the chip
    * @param addr Register address to write to
    * @param data Data to write
    */
-  void sciWrite(uint8_t addr, uint16_t data);
+  virtual void sciWrite(uint8_t addr, uint16_t data);
+  /*!
+   * @brief Start an SCI multiple write: any number of sciWriteWord() calls to
+   * the same register follow with CS held low. Writes to VS1053_REG_WRAM
+   * advance WRAMADDR, so a whole block is uploaded in one transaction.
+   * @param addr Register address to write to
+   */
+  void sciWriteBegin(uint8_t addr);
+  /*!
+   * @brief Send the next word of an SCI multiple write, waits for DREQ while
+   * the decoder executes the previous one
+   * @param data Data to write
+   * @return Returns false if DREQ stayed low for VS1053_SCI_TIMEOUT, the word
+   * is not sent and the caller ends the write with sciWriteEnd()
+   */
+  boolean sciWriteWord(uint16_t data);
+  /*!
+   * @brief End an SCI multiple write started with sciWriteBegin()
+   */
+  void sciWriteEnd(void);
   /*!
    * @brief Generate a sine-wave test signal
    * @param n Defines the sine test to use
@@ -177,6 +257,54 @@ public:
    */
   uint8_t spiread(void);
 
+  /*!
+   * @brief Set the clock multiplier and speed the SCI bus up to match. SCI
+   * runs at CLKI / 7, the read limit of the datasheet.
+   * @param clockf CLOCKF value with SC_FREQ 0, e.g. VS1053_CLOCKF_4X
+   */
+  void setClock(uint16_t clockf);
+  /*!
+   * @brief SCI bus speed of the current clock profile
+   * @return Requested SPI clock in Hz, the hardware rounds it down
+   */
+  uint32_t sciClock(void);
+  /*!
+   * @brief Measure sciRead() and sciWrite() at the pre-init and the current
+   * clock profile. Only reads STATUS and writes VOLUME back, so it is safe
+   * while playing.
+   */
+  void benchmarkSCI(void);
+
+  /*!
+   * @brief Read a parametric register through WRAMADDR and WRAM
+   * @param addr X memory address, e.g. VS1053_PARA_PLAYSPEED
+   * @return Register value
+   */
+  uint16_t paraRead(uint16_t addr);
+  /*!
+   * @brief Write a parametric register through WRAMADDR and WRAM
+   * @param addr X memory address, e.g. VS1053_PARA_SPEEDSHIFTER
+   * @param data Value to write
+   */
+  void paraWrite(uint16_t addr, uint16_t data);
+  /*!
+   * @brief Change the tempo without changing the pitch. Up to 164% only the
+   * speed shifter runs, above it playSpeed 2 skips every other frame and the
+   * shifter makes up the rest. Both are variables of the patches package, so
+   * the speed stays at 100% unless patchesActive(). The decoder then
+   * consumes the stream that much faster, the feeder has to keep up with
+   * bitrate * speed. Survives stopPlaying() and soft resets.
+   * @param percent Speed in percent of normal, clamped to VS1053_SPEED_MIN
+   * to VS1053_SPEED_MAX
+   * @return The speed set, 100 without the patches
+   */
+  uint16_t setPlaySpeed(uint16_t percent);
+  /*!
+   * @brief Speed set with setPlaySpeed()
+   * @return Speed in percent of normal
+   */
+  uint16_t playSpeed(void);
+
   /*!
    * @brief Reads the DECODETIME register from the chip
    * @return Returns the decode time as an unsigned 16-bit integer
@@ -203,20 +331,42 @@ public:
    * @brief Test if ready for more data
    * @return Returns true if it is ready for data
    */
-  boolean readyForData(void);
+  virtual boolean readyForData(void);
+  /*!
+   * @brief Compare the byte wise and the bulk SDI path. Streams zeros to the
+   * decoder, so only call it while nothing is playing. Prints cycles per 32
+   * byte chunk and the resulting CPU share at 128 and 320 kbps.
+   */
+  void benchmarkSDI(void);
   /*!
    * @brief Apply a code patch
    * @param patch Patch to apply
    * @param patchsize Patch size
+   * @return Returns false if the decoder stopped taking data, the patch is
+   * incomplete
    */
-  void applyPatch(const uint16_t *patch, uint16_t patchsize);
+  boolean applyPatch(const uint16_t *patch, uint16_t patchsize);
   /*!
    * @brief Load the specified plug-in
    * @param fn Plug-in to load
    * @return Either returns 0xFFFF if there is an error, or the address of the
    * plugin that was loaded
    */
-  uint16_t loadPlugin(char *fn);
+  uint16_t loadPlugin(const char *fn);
+  /*!
+   * @brief Load a patch package in plugin format and start it at the address
+   * of its execute record. Every reset wipes the patches, the driver loads
+   * them again after each soft or hardware reset it does.
+   * @param fn Patch file, the pointer is kept, e.g. a string literal
+   * @return Returns true if the patches run
+   */
+  boolean startPatches(const char *fn);
+  /*!
+   * @brief If the patches of startPatches() run, features like the speed
+   * shifter depend on them
+   * @return Returns false before startPatches() and after a failed reload
+   */
+  boolean patchesActive(void);
 
   /*!
    * @brief Write to a GPIO pin
@@ -277,6 +427,123 @@ public:
                                            //!< device
   long seekPosition = -1;
 
+  volatile uint16_t irqOffMaxMicros = 0; //!< longest stretch the driver ran with interrupts
+                                         //!< off, feeder interrupt included
+
+  /*!
+   * @brief Record a stretch with interrupts off. micros() only sees one timer
+   * overflow without interrupts, stretches beyond about 2 ms show up short.
+   * @param us Length of the stretch
+   */
+  void countIrqOff(uint32_t us)
+  {
+    if (us > irqOffMaxMicros)
+      irqOffMaxMicros = (us > 0xFFFF) ? 0xFFFF : us;
+  }
+
+protected:
+  /*!
+   * @brief Disable interrupts for a measured section. Sections nest, only
+   * the outermost one is measured and restores the interrupt state.
+   * @return Start time to pass to irqOn()
+   */
+  uint32_t irqOff(void)
+  {
+#if defined(SREG)
+    uint8_t sreg = SREG;
+#endif
+    noInterrupts();
+    if (_irqDepth++ == 0)
+    {
+#if defined(SREG)
+      _irqSreg = sreg;
+#endif
+    }
+    return micros();
+  }
+  /*!
+   * @brief End a section started with irqOff(), interrupts are only enabled
+   * again if they were on before, so it is safe in interrupt handlers
+   * @param start Return value of irqOff()
+   */
+  void irqOn(uint32_t start)
+  {
+    if (--_irqDepth)
+      return; // the enclosing section measures and restores
+    countIrqOff(micros() - start);
+#if defined(SREG)
+    SREG = _irqSreg;
+#else
+    interrupts();
+#endif
+  }
+
+  uint8_t _irqDepth = 0; //!< nesting of irqOff() sections
+  uint8_t _irqSreg = 0;  //!< interrupt state before the outermost one
+  /*!
+   * @brief Start an SDI transfer: data SPI settings and DCS low. Any number of
+   * spiwrite() calls may follow as long as DREQ is checked every 32 bytes.
+   */
+  void sdiBegin(void);
+  /*!
+   * @brief End an SDI transfer started with sdiBegin()
+   */
+  void sdiEnd(void);
+  /*!
+   * @brief Begin the SPI transaction for SDI data, chip selects untouched
+   */
+  void spiDataBegin(void);
+  /*!
+   * @brief End the SPI transaction for SDI data
+   */
+  void spiDataEnd(void);
+
+  /*!
+   * @brief Back to the pre-init SCI speed, the clock multiplier is gone
+   * after a soft reset until CLOCKF is written again
+   */
+  void sciSafeClock(void);
+  /*!
+   * @brief Write the speed registers for _speed, a soft reset clears them
+   */
+  void applySpeed(void);
+  /*!
+   * @brief Load and start _patchFile again after a reset
+   * @return Returns true if the patches run
+   */
+  boolean reloadPatches(void);
+
+  SPISettings _sciSetting = VS1053_CONTROL_SPI_SETTING; //!< SPI settings of SCI transfers
+  uint32_t _sciClock = 250000; //!< their clock
+  uint16_t _clockf = 0;        //!< CLOCKF set by setClock(), 0 before
+  uint16_t _speed = 100;       //!< play speed in percent, see setPlaySpeed()
+  const char *_patchFile = 0;  //!< file of startPatches(), 0 without patches
+  boolean _patchesActive = false; //!< AIADDR points at the loaded patches
+
+  PortReg *_csPort = 0;   //!< output register of the SCI chip select
+  PortReg *_dcsPort = 0;  //!< output register of the SDI chip select
+  PortReg *_dreqPort = 0; //!< input register of the data request pin
+  PortMask _csMask = 0;   //!< bit of the SCI chip select
+  PortMask _dcsMask = 0;  //!< bit of the SDI chip select
+  PortMask _dreqMask = 0; //!< bit of the data request pin
+
+  /*!
+   * @brief Pin access through the port registers resolved in begin(). Hot
+   * loops are templates on a pin type so VS1053Driver can substitute pins
+   * resolved at compile time.
+   */
+  struct RuntimePins
+  {
+    RuntimePins(Adafruit_VS1053 &vs)
+        : dcsPort(vs._dcsPort), dreqPort(vs._dreqPort), dcsMask(vs._dcsMask),
+          dreqMask(vs._dreqMask) {}
+    void dcsLow(void) { *dcsPort &= ~dcsMask; }
+    void dcsHigh(void) { *dcsPort |= dcsMask; }
+    boolean ready(void) { return (*dreqPort & dreqMask) != 0; }
+    PortReg *dcsPort, *dreqPort;
+    PortMask dcsMask, dreqMask;
+  };
+
 #ifdef ARDUINO_ARCH_SAMD
 protected:
   uint32_t _dreq;
@@ -293,6 +560,77 @@ private:
 #endif
 };
 
+/*!
+ * @brief Steps of the end of stream and cancel sequence of the VS1053b
+ * datasheet. A file that ends is drained with end fill bytes and then
+ * cancelled, a stopped file is cancelled and then flushed.
+ */
+enum VS1053_EndState : uint8_t
+{
+  VS1053_END_IDLE,   //!< nothing to finish
+  VS1053_END_DRAIN,  //!< file fully sent, end fill bytes push out its last frames
+  VS1053_END_CANCEL, //!< SM_CANCEL set, fill bytes until the decoder clears it
+  VS1053_END_FLUSH,  //!< decoder stopped, end fill bytes clear its buffer
+  VS1053_END_RESET   //!< SM_CANCEL was not cleared, soft reset in progress
+};
+
+/*!
+ * @brief Progress of an asynchronous start, see
+ * Adafruit_VS1053_FilePlayer::startState()
+ */
+enum VS1053_StartState : uint8_t
+{
+  VS1053_START_NONE,    //!< nothing started or playback stopped
+  VS1053_START_ARMED,   //!< file open, the decoder still ends the previous one
+  VS1053_START_FEEDING, //!< decoder reset, waiting for the first data to reach it
+  VS1053_START_PLAYING  //!< the decoder has data of the track
+};
+
+/*!
+ * @brief What the file player is doing, see VS1053_PlayerStatus
+ */
+enum VS1053_PlayState : uint8_t
+{
+  VS1053_STATE_STOPPED,  //!< no file open, the decoder is idle
+  VS1053_STATE_STARTING, //!< file open, no audio reached the decoder yet
+  VS1053_STATE_PLAYING,  //!< the feeder sends the file
+  VS1053_STATE_PAUSED,   //!< file open, the feeder is held
+  VS1053_STATE_ENDING    //!< file done or stopped, the decoder still finishes it
+};
+
+/*!
+ * @brief Snapshot of the file player, taken with
+ * Adafruit_VS1053_FilePlayer::status()
+ */
+struct VS1053_PlayerStatus
+{
+  VS1053_PlayState state; //!< what the player is doing
+  uint16_t track;         //!< counts the files started or switched to, a change is a new track
+  uint32_t position;      //!< next byte of the track going to the decoder
+  uint32_t size;          //!< file size of the track, 0 without one
+  uint16_t decodeTime;    //!< DECODETIME in seconds at the last telemetry sample
+
+  /*!
+   * @brief If the feeder runs, same as playingMusic
+   * @return Returns true while starting or playing
+   */
+  boolean playing(void) const
+  {
+    return state == VS1053_STATE_STARTING || state == VS1053_STATE_PLAYING;
+  }
+};
+
+/*!
+ * @brief Producer read statistics of one read path
+ */
+struct VS1053_ReadStats
+{
+  uint32_t reads;     //!< card reads
+  uint32_t bytes;     //!< bytes delivered to the ring
+  uint32_t micros;    //!< time spent reading
+  uint16_t maxMicros; //!< longest single read
+};
+
 /*!
  * @brief File player for the Adafruit VS1053
  */
@@ -344,16 +682,135 @@ public:
   /*!
    * @brief Specifies the argument to use for interrupt-driven playback
    * @param type interrupt to use. Valid arguments are
-   * VS1053_FILEPLAYER_TIMER0_INT and VS1053_FILEPLAYER_PIN_INT
+   * VS1053_FILEPLAYER_TIMER0_INT, VS1053_FILEPLAYER_PIN_INT and
+   * VS1053_FILEPLAYER_HYBRID_INT. Can be called again to switch.
    * @return Returs true/false for success/failure
    */
   boolean useInterrupt(uint8_t type);
+
+  /*!
+   * @brief DREQ interrupt entry. The hybrid scheduler fires on the rising
+   * edge only. A run that sent less than VS1053_HYBRID_MINBURST chunks found
+   * the decoder FIFO nearly full, so the following edges are left to the
+   * next tick, which then sends a burst the size of what the decoder used
+   * meanwhile. Larger runs, e.g. after a start or an underrun, keep the edges.
+   */
+  void feedEdge(void);
+
+  /*!
+   * @brief Timer interrupt entry. Feeds on every call in timer mode. The
+   * hybrid scheduler acts every VS1053_HYBRID_TICK calls, lets edges through
+   * again and feeds if DREQ is high, which recovers edges nobody served.
+   */
+  void feedTick(void);
+
+  /*!
+   * @brief Select producer/consumer playback. With the ring enabled the
+   * interrupt only copies buffered chunks to the decoder and all SD card reads
+   * happen in feedRing(), which has to be called from the main loop.
+   * @param enable true to feed from the ring, false to read the SD card from
+   * the interrupt
+   */
+  void useRingBuffer(boolean enable);
+
+  /*!
+   * @brief Refill the audio ring from the current track in sector sized
+   * reads. Call as often as possible from the main loop, never from an
+   * interrupt.
+   */
+  void feedRing(void);
+
+  /*!
+   * @brief Open the track that follows the current one. When the current file
+   * ends, feedRing() continues with it in the same decode stream, without
+   * cancel or reset. Needs the ring, see useRingBuffer().
+   * @param trackname File to play next
+   * @param audioStart Offset of the first frame if known, e.g. from an index
+   * @return Returns true if the file is queued
+   */
+  boolean queueNextFile(const char *trackname,
+                        uint32_t audioStart = VS1053_AUDIOSTART_PROBE);
+
+  /*!
+   * @brief Queue the following track by its directory entry, see
+   * queueNextFile() and startPlayingEntry()
+   * @param dir Open directory holding the track
+   * @param entryIndex Index of the track's entry in dir
+   * @param audioStart Offset of the first frame if known, e.g. from an index
+   * @return Returns true if the file is queued
+   */
+  boolean queueNextEntry(FatFile *dir, uint16_t entryIndex,
+                         uint32_t audioStart = VS1053_AUDIOSTART_PROBE);
+
+  /*!
+   * @brief Claim the SD card for the main loop while music plays, e.g. to
+   * read the library index or open another file. Calls may nest.
+   *
+   * The bus itself is arbitrated by SPI transactions: the VS1053, SdFat and
+   * the MFRC522 all use them and useInterrupt() registers DREQ with
+   * SPI.usingInterrupt(), so the feeder only runs between two transfers of the
+   * other devices. With the ring the feeder never touches the card and the
+   * ring is topped up here, so DREQ stays served from RAM during the access.
+   * Without the ring the interrupt reads the file itself and is held off the
+   * card until endBusAccess().
+   */
+  void beginBusAccess(void);
+
+  /*!
+   * @brief Release the SD card claimed by beginBusAccess() and catch up with
+   * the decoder
+   */
+  void endBusAccess(void);
+
+  uint16_t busAccesses = 0;   //!< completed beginBusAccess() / endBusAccess() pairs
+  uint16_t busUnderruns = 0;  //!< ring underruns that happened during them
+
+  /*!
+   * @brief Test if a track is queued
+   * @return Returns true if queueNextFile() is pending
+   */
+  boolean nextQueued(void);
+
+  /*!
+   * @brief Reports a switch to the queued track once
+   * @return Returns true if the first audio of the queued track went to the
+   * decoder since the last call
+   */
+  boolean queuedTrackStarted(void);
+
+  /*!
+   * @brief Consistent copy of the playback health counters, see
+   * AdaMisch_Telemetry.h
+   * @param t Receives the counters
+   */
+  void telemetry(VS1053_Telemetry *t);
+
+  /*!
+   * @brief Consistent copy of state, position, size, track and decode time.
+   * The feeder interrupt updates them under a sequence counter, the copy is
+   * repeated if it ran meanwhile, so interrupts stay on.
+   * @param s Receives the status
+   */
+  void status(VS1053_PlayerStatus *s);
+
+  VS1053_ReadStats rawReads = {};   //!< sector reads straight from the card, contiguous files
+  VS1053_ReadStats fileReads = {};  //!< reads through the FAT layer, fragmented files
+
+  uint32_t lastSwitchMicros = 0;    //!< time from end of file to first sector of the queued one
+  uint16_t lastSwitchUnderruns = 0; //!< ring underruns during that switch, 0 means gapless
+  volatile uint32_t lastGapMicros = 0; //!< decoder starved from the first DREQ on an empty ring to the first chunk of the queued file, 0 if gapless
+
   File currentTrack;             //!< File that is currently playing
-  volatile boolean playingMusic; //!< Whether or not music is playing
+  volatile boolean playingMusic = false; //!< Whether or not music is playing
+  volatile uint16_t ringUnderruns = 0;   //!< DREQ requests that found the ring empty
+  volatile uint16_t feedCollisions = 0;  //!< feedBuffer() calls that found the feeder running
+  volatile uint16_t feedReruns = 0;      //!< extra feeder runs that served them
   
   /*!
    * @brief Feeds the buffer. Reads mp3 file data from the SD card and file and
-   * puts it into the buffer that the decoder reads from to play a file
+   * puts it into the buffer that the decoder reads from to play a file. A call
+   * while the feeder already runs, e.g. the DREQ interrupt hitting the main
+   * loop's call, is not lost: the running feeder loops once more.
    */
   void feedBuffer(void);
   
@@ -373,7 +830,9 @@ public:
   
   /*!
    * @brief Begin playing the specified file from the SD card using
-   * interrupt-drive playback.
+   * interrupt-drive playback. Returns once the file is open and the stream is
+   * armed, with interrupts enabled throughout. The DREQ interrupt or the next
+   * feedRing() sends the first data, see startState().
    * @param *trackname File to play
    * @return Returns true when file starts playing
    */
@@ -383,10 +842,32 @@ public:
    * @brief Begin playing the specified file at a given file offest from the 
    * SD card using interrupt-drive playback.
    * @param *trackname File to play, position within file
+   * @param audioStart Offset of the first frame if known, e.g. from an index.
+   * Used when pos is 0 and saves the ID3 probe.
    * @return Returns true when file starts playing
    */
-  boolean startPlayingFile(const char *trackname, uint32_t pos);
+  boolean startPlayingFile(const char *trackname, uint32_t pos,
+                           uint32_t audioStart = VS1053_AUDIOSTART_PROBE);
+
+  /*!
+   * @brief Begin playing an mp3 file given by its directory entry. Opens the
+   * file with one entry read instead of walking the path name by name.
+   * @param dir Open directory holding the track
+   * @param entryIndex Index of the track's entry in dir, see FatFile::dirIndex()
+   * @param pos Position within the file, 0 to start at the beginning
+   * @param audioStart Offset of the first frame if known, see startPlayingFile()
+   * @return Returns true when file starts playing
+   */
+  boolean startPlayingEntry(FatFile *dir, uint16_t entryIndex, uint32_t pos,
+                            uint32_t audioStart = VS1053_AUDIOSTART_PROBE);
   
+  /*!
+   * @brief Progress of the last startPlayingFile() or startPlayingEntry(),
+   * both return before any audio reached the decoder
+   * @return Returns VS1053_START_PLAYING once the decoder got the first data
+   */
+  VS1053_StartState startState(void);
+
   /*!
    * @brief returns the file size of the current file
    * @param *void
@@ -407,6 +888,49 @@ public:
    * @return void
    */
   void fileSeek(long position);
+
+  /*!
+   * @brief Jump relative to the current play time. The target is mapped to a
+   * file offset with the Xing/VBRI table of the track (or its bitrate for CBR
+   * files) and moved forward to the next frame header.
+   * @param seconds Seconds to skip, negative to rewind
+   * @return Returns false if the track has no seek info or the target lies
+   * behind its end
+   */
+  boolean seekSeconds(int16_t seconds);
+
+  /*!
+   * @brief Jump to a share of the play time, see seekSeconds()
+   * @param percent 0 to 99
+   * @return Returns false if the track has no seek info
+   */
+  boolean seekPercent(uint8_t percent);
+
+  /*!
+   * @brief Play time of the next byte going to the decoder
+   * @return Milliseconds, 0 if unknown
+   */
+  uint32_t positionMillis(void);
+
+  /*!
+   * @brief Play time at a byte of the current track, e.g. the position of
+   * a status() snapshot
+   * @param position Byte offset in the track
+   * @return Milliseconds, 0 if unknown
+   */
+  uint32_t millisAt(uint32_t position);
+
+  /*!
+   * @brief Play time of the current track
+   * @return Milliseconds, 0 if unknown
+   */
+  uint32_t durationMillis(void);
+
+  /*!
+   * @brief Seconds startPlayingFile() goes back when resuming at a position
+   * @param seconds Rewind on resume, 0 to continue at the exact position
+   */
+  void setResumeRewind(uint8_t seconds);
   
   /*!
    * @brief Play the complete file. This function will not return until the
@@ -416,10 +940,21 @@ public:
    */
   boolean playFullFile(const char *trackname);
   /*!
-   * @brief Stop Playback
+   * @brief Stop Playback. The decoder is cancelled as the datasheet requires,
+   * feedRing() completes that without blocking and a new start waits for it
+   * in VS1053_START_ARMED.
    * @return Returns file position when stopping
    */
   uint32_t stopPlaying(void);
+
+  /*!
+   * @brief If the decoder is still finishing a track, either playing out the
+   * end of the file or cancelling a stopped one
+   * @return Returns true until the end sequence is done
+   */
+  boolean ending(void);
+
+  uint16_t cancelResets = 0; //!< cancels the decoder didn't acknowledge, ended by a soft reset
   
   /*!
    * @brief If playback is paused
@@ -438,9 +973,181 @@ public:
    */
   void pausePlaying(boolean pause);
 
+protected:
+  /*!
+   * @brief Consumer side of the ring, runs in interrupt context and never
+   * touches the SD card
+   */
+  virtual void feedFromRing(void);
+
+  /*!
+   * @brief Send everything DREQ lets through from the ring in one SPI
+   * transaction and one DCS window
+   * @param pins Pin access, RuntimePins or compile time pins
+   */
+  template <class Pins> void feedRingWith(Pins pins)
+  {
+    if (_ringDiscard)
+    {
+      // producer is about to seek, drop the read ahead data
+      _ring.discard();
+      _ringDiscard = false;
+    }
+
+    boolean selected = false;
+    uint8_t burst = 0;
+    while (pins.ready())
+    {
+      if (_ring.empty())
+      {
+        if (_ringEof)
+        {
+          // last byte is in the decoder, the main loop drains it and closes the file
+          playingMusic = false;
+          _trackDone = true;
+        }
+        else
+        {
+          ringUnderruns++;
+          _telemetry.starved++;
+          if (!_starving)
+          {
+            _starving = true;
+            _starveStart = micros();
+          }
+        }
+        break;
+      }
+      uint8_t len = _ring.chunkLen();
+      if (len)
+      {
+        if (_gapWatch && _fedPosition >= 0)
+        {
+          // first chunk of the queued file, the decoder starved since the first empty DREQ
+          lastGapMicros = _starving ? micros() - _starveStart : 0;
+          _gapWatch = false;
+          _queuedStarted = true;
+        }
+        _starving = false;
+        if (!selected)
+        {
+          spiDataBegin();
+          pins.dcsLow();
+          selected = true;
+        }
+        spiwrite(_ring.chunk(), len);
+        _fedPosition += len;
+        burst++;
+#if VS1053_TELEMETRY
+        _telemetry.fedBytes += len;
+#endif
+      }
+      _ring.pop();
+    }
+    _burst = burst;
+    if (selected)
+    {
+      pins.dcsHigh();
+      spiDataEnd();
+      if (_startState == VS1053_START_FEEDING)
+        _startState = VS1053_START_PLAYING;
+    }
+  }
+
 private:
   void feedBuffer_noLock(void);
+  boolean startPlayingOpened(uint32_t position, uint32_t audioStart, boolean mp3);
+  void cancelPrevious(void);
+  void loadEndFill(void);
+  void enterEnd(VS1053_EndState state);
+  void beginCancel(boolean flush);
+  void resetDecoder(void);
+  boolean endStep(void);
+  boolean endMoving(void);
+  void startStream(void);
+  int readFile(void);
+  int readRaw(void);
+  void openRead(uint32_t contiguousBlock);
+  boolean blockAt(uint32_t position, uint32_t *block);
+  int readAt(uint32_t position, uint8_t *buf, uint16_t len);
+  void seekRead(uint32_t position);
+  uint32_t readPosition(void);
+  uint32_t trackPosition(void);
+  boolean loadSeekInfo(void);
+  void serviceRing(void);
+  VS1053_PlayState playState(void);
+  void publishStatus(void);
+  void updateStatus(void);
+  void sampleTelemetry(void);
+  void watchdog(void);
+  void recoverDecoder(void);
+  void restartStream(uint32_t position);
+  void countIsr(uint32_t us);
+  boolean seekMillis(uint32_t ms);
+  uint32_t frameOffset(uint32_t ms);
+  static int readTrack(void *player, uint32_t pos, uint8_t *buf, uint16_t len);
   uint8_t _cardCS;
+
+  mp3SeekInfo _seekInfo;           //!< time to offset mapping of currentTrack
+  boolean _seekInfoValid = false;  //!< _seekInfo belongs to currentTrack
+  uint8_t _resumeRewind = 0;       //!< seconds to go back on resume
+
+  AudioRing _ring;                      //!< sectors read ahead of the decoder
+  boolean _useRing = false;             //!< feed from _ring instead of the file
+  volatile boolean _ringEof = false;    //!< producer reached the end of the file
+  volatile boolean _ringDiscard = false; //!< consumer has to drop the ring
+  volatile boolean _trackDone = false;  //!< consumer played the last byte
+
+  VS1053_EndState _endState = VS1053_END_IDLE; //!< progress of the end sequence
+  boolean _endFlush = false;        //!< flush after the cancel, the track was stopped
+  uint16_t _endBytes = 0;           //!< fill bytes sent in the current step
+  uint32_t _endStart = 0;           //!< millis() at the start of the current step
+  uint16_t _endVolume = 0;          //!< volume to restore after a soft reset
+  uint16_t _endMark = 0;            //!< _endBytes at the last drain progress check
+  uint16_t _endDecodeTime = 0;      //!< DECODETIME at the last drain progress check
+  volatile VS1053_StartState _startState = VS1053_START_NONE; //!< see startState()
+
+  VS1053_Telemetry _telemetry = {}; //!< feeder updates it, read with telemetry()
+  uint32_t _sampleBytes = 0;        //!< fedBytes at the last decoder sample
+  uint32_t _sampleIsr = 0;          //!< isrMicros at the last decoder sample
+
+  VS1053_PlayerStatus _status = {}; //!< read with status()
+  volatile uint8_t _statusSeq = 0;  //!< odd while _status is written
+  volatile int32_t _fedPosition = 0; //!< consumer side track position, below 0 while the ring holds the previous file
+  uint16_t _trackId = 0;            //!< _status.track
+
+  uint32_t _wdSample = 0;           //!< millis() of the last watchdog sample, 0 starts over
+  uint32_t _wdProgress = 0;         //!< millis() the decoder last advanced
+  uint16_t _wdDecodeTime = 0;       //!< DECODETIME at the last watchdog sample
+  uint16_t _wdStarved = 0;          //!< _telemetry.starved at the last watchdog sample
+  uint32_t _wdGoodPos = 0;          //!< trackPosition() the decoder last advanced at
+  uint8_t _wdLevel = 0;             //!< recoveries since then: cancel, soft reset, reset, give up
+
+  uint8_t _scheduler = 0;           //!< type given to useInterrupt()
+  volatile uint8_t _burst = 0;      //!< chunks sent by the last feeder run
+  volatile boolean _edgeHold = false; //!< hybrid: DREQ edges left to the next tick
+  uint8_t _tickCount = 0;           //!< timer calls since the last hybrid tick
+  uint8_t _dreqIntMask = 0;         //!< EIMSK bit of DREQ, SPI transactions clear it while they run
+
+  volatile uint8_t _busHeld = 0;    //!< nesting of beginBusAccess(), direct mode feeder keeps off the card
+  uint16_t _busUnderrunStart;       //!< ringUnderruns at the outermost beginBusAccess()
+
+  uint32_t _rawBlock = 0;           //!< first card block of a contiguous currentTrack, 0 reads through the file
+  boolean _rawChain = false;        //!< fragmented currentTrack read by its cluster chain
+  uint32_t _rawPos = 0;             //!< next byte readRaw() delivers
+  uint32_t _clusterBytes = 0;       //!< cluster size of the volume of currentTrack
+  ClusterCache _clusters;           //!< sparse chain of currentTrack for _rawChain
+  uint32_t _scratchBlock = 0;       //!< block readAt() left in the SdFat cache buffer, 0 if none
+  uint32_t _nextRawBlock = 0;       //!< _rawBlock of _nextTrack
+
+  File _nextTrack;                  //!< queued file, already behind its ID3 tag
+  boolean _switching = false;       //!< switched to _nextTrack, no data read yet
+  volatile boolean _queuedStarted = false; //!< switch not reported yet
+  volatile boolean _gapWatch = false; //!< feeder measures the gap of a switch
+  volatile boolean _starving = false; //!< the last DREQ found the ring empty
+  uint32_t _starveStart;            //!< micros() of the first DREQ on the empty ring
+  uint32_t _switchStart;            //!< micros() at the end of the previous file
+  uint16_t _switchUnderruns;        //!< ringUnderruns at the end of the previous file
 };
 
 #endif // ADAFRUIT_VS1053_H
@@ -0,0 +1,126 @@
+/*!
+ * @file AdaMisch_VS1053Driver.h
+ *
+ * VS1053 file player with the pins fixed at compile time. It keeps the whole
+ * Adafruit_VS1053_FilePlayer API and only replaces the hot paths: SCI access,
+ * the DREQ test and the ring feeder, so CS toggling and the DREQ check each
+ * become a single instruction on ports A to G.
+ */
+
+#ifndef ADAMISCH_VS1053DRIVER_H
+#define ADAMISCH_VS1053DRIVER_H
+
+#include "AdaMisch_VS1053.h"
+#include "AdaMisch_FastPin.h"
+
+/*!
+ * @brief Hardware SPI file player with compile time pins
+ * @tparam CS SCI Chip Select pin
+ * @tparam DCS SDI Chip Select pin
+ * @tparam DREQ Data Request pin
+ * @tparam CARDCS CS pin for the SD card on the SPI bus
+ */
+template <uint8_t CS, uint8_t DCS, uint8_t DREQ, uint8_t CARDCS>
+class VS1053Driver : public Adafruit_VS1053_FilePlayer
+{
+public:
+  /*!
+   * @brief Hardware SPI constructor
+   * @param rst Reset pin, -1 if not connected
+   */
+  VS1053Driver(int8_t rst = -1)
+      : Adafruit_VS1053_FilePlayer(rst, CS, DCS, DREQ, CARDCS) {}
+
+  boolean readyForData(void) { return FastPin<DREQ>::read(); }
+
+  uint16_t sciRead(uint8_t addr)
+  {
+    uint16_t data;
+
+    SPI.beginTransaction(_sciSetting);
+    FastPin<CS>::low();
+    spiwrite(VS1053_SCI_READ);
+    spiwrite(addr);
+    delayMicroseconds(10);
+    data = spiread();
+    data <<= 8;
+    data |= spiread();
+    FastPin<CS>::high();
+    SPI.endTransaction();
+
+    return data;
+  }
+
+  void sciWrite(uint8_t addr, uint16_t data)
+  {
+    SPI.beginTransaction(_sciSetting);
+    FastPin<CS>::low();
+    spiwrite(VS1053_SCI_WRITE);
+    spiwrite(addr);
+    spiwrite(data >> 8);
+    spiwrite(data & 0xFF);
+    FastPin<CS>::high();
+    SPI.endTransaction();
+  }
+
+  /*!
+   * @brief Print RAM footprint and the cost of the pin access paths of this
+   * driver against the runtime resolved ones of Adafruit_VS1053_FilePlayer.
+   * Only SCI reads are issued, so it is safe while playing.
+   */
+  void benchmarkPins(void)
+  {
+    const uint16_t n = 1000;
+    uint32_t t;
+    volatile boolean r;
+
+    Serial.print(F("RAM FilePlayer: "));
+    Serial.print(sizeof(Adafruit_VS1053_FilePlayer));
+    Serial.print(F(" VS1053Driver: "));
+    Serial.println(sizeof(*this));
+
+    t = micros();
+    for (uint16_t i = 0; i < n; i++)
+      r = digitalRead(DREQ);
+    printNanos(F("DREQ digitalRead ns: "), micros() - t, n);
+    t = micros();
+    for (uint16_t i = 0; i < n; i++)
+      r = Adafruit_VS1053::readyForData();
+    printNanos(F("DREQ runtime port ns: "), micros() - t, n);
+    t = micros();
+    for (uint16_t i = 0; i < n; i++)
+      r = readyForData();
+    printNanos(F("DREQ compile time ns: "), micros() - t, n);
+    (void)r;
+
+    t = micros();
+    for (uint16_t i = 0; i < n; i++)
+      Adafruit_VS1053::sciRead(VS1053_REG_STATUS);
+    printNanos(F("sciRead runtime port ns: "), micros() - t, n);
+    t = micros();
+    for (uint16_t i = 0; i < n; i++)
+      sciRead(VS1053_REG_STATUS);
+    printNanos(F("sciRead compile time ns: "), micros() - t, n);
+  }
+
+protected:
+  //! the pin type the ring feeder is instantiated with
+  struct StaticPins
+  {
+    void dcsLow(void) { FastPin<DCS>::low(); }
+    void dcsHigh(void) { FastPin<DCS>::high(); }
+    boolean ready(void) { return FastPin<DREQ>::read(); }
+  };
+
+  void feedFromRing(void) { feedRingWith(StaticPins()); }
+
+private:
+  static void printNanos(const __FlashStringHelper *label, uint32_t us,
+                         uint16_t n)
+  {
+    Serial.print(label);
+    Serial.println(us * 1000UL / n);
+  }
+};
+
+#endif // ADAMISCH_VS1053DRIVER_H
@@ -0,0 +1,283 @@
+/***************************************************
+mp3Frame
+
+MPEG audio frame header and Xing/VBRI seek table parsing.
+
+****************************************************/
+
+#include "mp3Frame.h"
+#include <string.h>
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#endif
+
+// bitrates in units of 8 kbit/s, index 0 (free format) and 15 (bad) are invalid
+static const uint8_t bitrateTable[5][16] PROGMEM = {
+    {0, 4, 8, 12, 16, 20, 24, 28, 32, 36, 40, 44, 48, 52, 56, 0}, // MPEG1 layer I
+    {0, 4, 6, 7, 8, 10, 12, 14, 16, 20, 24, 28, 32, 40, 48, 0},   // MPEG1 layer II
+    {0, 4, 5, 6, 7, 8, 10, 12, 14, 16, 20, 24, 28, 32, 40, 0},    // MPEG1 layer III
+    {0, 4, 6, 7, 8, 10, 12, 14, 16, 18, 20, 22, 24, 28, 32, 0},   // MPEG2/2.5 layer I
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 10, 12, 14, 16, 18, 20, 0},       // MPEG2/2.5 layer II & III
+};
+
+static const uint16_t sampleRateTable[3] = {44100, 48000, 32000}; // MPEG1, halved for 2, quartered for 2.5
+
+static uint32_t readBE32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t readBE16(const uint8_t *p)
+{
+  return ((uint16_t)p[0] << 8) | p[1];
+}
+
+bool mp3ParseHeader(const uint8_t *p, mp3FrameHeader *h)
+{
+  if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0)
+    return false; // no sync word
+
+  uint8_t versionBits = (p[1] >> 3) & 0x03;
+  uint8_t layerBits = (p[1] >> 1) & 0x03;
+  uint8_t bitrateIndex = p[2] >> 4;
+  uint8_t rateIndex = (p[2] >> 2) & 0x03;
+  uint8_t padding = (p[2] >> 1) & 0x01;
+
+  if (versionBits == 1 || layerBits == 0 || rateIndex == 3)
+    return false; // reserved values
+  h->version = (versionBits == 3) ? 1 : (versionBits == 2) ? 2 : 3;
+  h->layer = 4 - layerBits;
+  h->mono = ((p[3] >> 6) == 3);
+
+  uint8_t table = (h->version == 1) ? h->layer - 1 : (h->layer == 1) ? 3 : 4;
+  h->bitrate = pgm_read_byte(&bitrateTable[table][bitrateIndex]) * 8;
+  if (h->bitrate == 0)
+    return false; // free format or bad index, can't compute frame length
+  h->sampleRate = sampleRateTable[rateIndex] >> (h->version - 1);
+
+  uint32_t bits = (uint32_t)h->bitrate * 1000;
+  if (h->layer == 1)
+  {
+    h->samplesPerFrame = 384;
+    h->frameLen = (12 * bits / h->sampleRate + padding) * 4;
+  }
+  else
+  {
+    h->samplesPerFrame = (h->layer == 3 && h->version != 1) ? 576 : 1152;
+    h->frameLen = (h->samplesPerFrame / 8) * bits / h->sampleRate + padding;
+  }
+  return true;
+}
+
+bool mp3ParseHdat(uint16_t hdat1, uint16_t hdat0, mp3FrameHeader *h)
+{
+  uint8_t p[4] = {(uint8_t)(hdat1 >> 8), (uint8_t)hdat1, (uint8_t)(hdat0 >> 8), (uint8_t)hdat0};
+  return mp3ParseHeader(p, h);
+}
+
+uint32_t mp3ID3Size(const uint8_t *p)
+{
+  if (p[0] != 'I' || p[1] != 'D' || p[2] != '3')
+    return 0;
+  // size is synchsafe: 4 x 7 bit, without the 10 byte header
+  uint32_t size = 0;
+  for (uint8_t i = 6; i < 10; i++)
+    size = (size << 7) | (p[i] & 0x7F);
+  size += 10;
+  if (p[5] & 0x10) // footer present
+    size += 10;
+  return size;
+}
+
+// true if h is a frame of the stream described by ref
+static bool sameStream(const mp3FrameHeader *h, const mp3SeekInfo *ref)
+{
+  return ref == 0 || (h->version == ref->version && h->layer == ref->layer &&
+                      h->sampleRate == ref->sampleRate);
+}
+
+int32_t mp3FindFrame(mp3Reader read, void *ctx, uint32_t from, uint16_t limit,
+                     const mp3SeekInfo *ref, mp3FrameHeader *h)
+{
+  uint8_t buf[64];
+  uint32_t pos = from;
+
+  while (pos < from + limit)
+  {
+    int n = read(ctx, pos, buf, sizeof(buf));
+    if (n < 4)
+      return -1;
+    for (int i = 0; i + 4 <= n; i++)
+    {
+      if (buf[i] != 0xFF || !mp3ParseHeader(buf + i, h) || !sameStream(h, ref))
+        continue;
+      // a frame header followed by another one is a sync, not just data
+      uint8_t next[4];
+      mp3FrameHeader nh;
+      if (read(ctx, pos + i + h->frameLen, next, 4) == 4 && mp3ParseHeader(next, &nh) &&
+          nh.version == h->version && nh.layer == h->layer && nh.sampleRate == h->sampleRate)
+      {
+        return pos + i;
+      }
+    }
+    pos += n - 3; // overlap so a header across the window border is found
+  }
+  return -1;
+}
+
+// build a percent table from the VBRI segment list
+static void readVbriToc(mp3Reader read, void *ctx, uint32_t pos, const uint8_t *vbri,
+                        mp3SeekInfo *info, uint32_t frames)
+{
+  uint16_t entries = readBE16(vbri + 18);
+  uint16_t scale = readBE16(vbri + 20);
+  uint16_t entrySize = readBE16(vbri + 22);
+  uint16_t framesPerEntry = readBE16(vbri + 24);
+  uint8_t buf[4];
+  uint32_t prevFrames = 0, prevBytes = 0, bytes = 0;
+  uint8_t p = 0;
+
+  // corrupt headers must not divide by zero below
+  if (entrySize == 0 || entrySize > 4 || frames == 0 || framesPerEntry == 0 || info->audioBytes == 0)
+    return;
+  for (uint16_t e = 0; e < entries && p < MP3_TOC_SIZE; e++)
+  {
+    if (read(ctx, pos + (uint32_t)e * entrySize, buf, entrySize) != entrySize)
+      return;
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < entrySize; i++)
+      value = (value << 8) | buf[i];
+    bytes += value * scale;
+    uint32_t curFrames = (uint32_t)(e + 1) * framesPerEntry;
+    // every percent mark inside this segment is interpolated linearly
+    while (p < MP3_TOC_SIZE && (uint64_t)p * frames <= (uint64_t)curFrames * 100)
+    {
+      uint32_t pFrames = (uint64_t)p * frames / 100;
+      uint32_t at = prevBytes + (uint64_t)(bytes - prevBytes) * (pFrames - prevFrames) /
+                                    (curFrames - prevFrames);
+      uint32_t t = (uint64_t)at * 256 / info->audioBytes;
+      info->toc[p++] = (t > 255) ? 255 : t;
+    }
+    prevFrames = curFrames;
+    prevBytes = bytes;
+  }
+  if (p == 0)
+    return;
+  while (p < MP3_TOC_SIZE) // short tables end at the last entry
+  {
+    info->toc[p] = info->toc[p - 1];
+    p++;
+  }
+  info->hasToc = true;
+}
+
+bool mp3ReadSeekInfo(mp3Reader read, void *ctx, uint32_t start, uint32_t fileSize,
+                     mp3SeekInfo *info)
+{
+  uint8_t buf[26];
+  mp3FrameHeader h;
+
+  memset(info, 0, sizeof(*info));
+  if (read(ctx, start, buf, 10) == 10)
+    start += mp3ID3Size(buf);
+
+  int32_t first = mp3FindFrame(read, ctx, start, 4096, 0, &h);
+  if (first < 0)
+    return false;
+  info->audioStart = first;
+  info->audioBytes = (fileSize > (uint32_t)first) ? fileSize - first : 0;
+  info->bitrate = h.bitrate;
+  info->sampleRate = h.sampleRate;
+  info->version = h.version;
+  info->layer = h.layer;
+
+  uint32_t frames = 0;
+  // Xing/Info sits behind the side information of the first frame
+  uint8_t sideInfo = (h.version == 1) ? (h.mono ? 17 : 32) : (h.mono ? 9 : 17);
+  if (read(ctx, first + 4 + sideInfo, buf, 16) == 16 &&
+      (!memcmp(buf, "Xing", 4) || !memcmp(buf, "Info", 4)))
+  {
+    uint32_t flags = readBE32(buf + 4);
+    uint8_t *field = buf + 8;
+    if (flags & 0x01)
+    {
+      frames = readBE32(field);
+      field += 4;
+    }
+    if (flags & 0x02)
+    {
+      uint32_t bytes = readBE32(field);
+      field += 4;
+      if (bytes > 0 && bytes <= info->audioBytes)
+        info->audioBytes = bytes;
+    }
+    if (flags & 0x04)
+    {
+      uint32_t tocPos = first + 4 + sideInfo + (field - buf);
+      info->hasToc = (read(ctx, tocPos, info->toc, MP3_TOC_SIZE) == MP3_TOC_SIZE);
+    }
+  }
+  // VBRI always follows 32 bytes after the header
+  else if (read(ctx, first + 36, buf, 26) == 26 && !memcmp(buf, "VBRI", 4))
+  {
+    uint32_t bytes = readBE32(buf + 10);
+    frames = readBE32(buf + 14);
+    if (bytes > 0 && bytes <= info->audioBytes)
+      info->audioBytes = bytes;
+    readVbriToc(read, ctx, first + 36 + 26, buf, info, frames);
+  }
+
+  if (frames)
+  {
+    info->duration = (uint64_t)frames * h.samplesPerFrame * 1000 / h.sampleRate;
+    if (info->duration)
+      info->bitrate = (uint64_t)info->audioBytes * 8 / info->duration;
+  }
+  else
+  {
+    info->duration = (uint64_t)info->audioBytes * 8 / info->bitrate;
+  }
+  return info->bitrate != 0;
+}
+
+uint32_t mp3TimeToOffset(const mp3SeekInfo *info, uint32_t ms)
+{
+  if (ms >= info->duration)
+    ms = info->duration;
+  if (!info->hasToc || info->duration == 0)
+    return info->audioStart + (uint64_t)ms * info->bitrate / 8;
+
+  // percent with remainder, then interpolate between two table entries
+  uint64_t scaled = (uint64_t)ms * MP3_TOC_SIZE;
+  uint8_t p = scaled / info->duration;
+  if (p >= MP3_TOC_SIZE)
+    p = MP3_TOC_SIZE - 1;
+  uint32_t frac = scaled - (uint64_t)p * info->duration;
+  uint16_t a = info->toc[p];
+  uint16_t b = (p < MP3_TOC_SIZE - 1) ? info->toc[p + 1] : 256;
+  uint64_t fx = (uint64_t)a * info->duration + (uint64_t)(b - a) * frac; // 1/256 units * duration
+  return info->audioStart + fx * info->audioBytes / (256 * (uint64_t)info->duration);
+}
+
+uint32_t mp3OffsetToTime(const mp3SeekInfo *info, uint32_t offset)
+{
+  uint32_t rel = (offset > info->audioStart) ? offset - info->audioStart : 0;
+  if (rel >= info->audioBytes)
+    return info->duration;
+  if (!info->hasToc || info->audioBytes == 0)
+    return info->bitrate ? (uint64_t)rel * 8 / info->bitrate : 0;
+
+  // position in 1/256 of the audio bytes with 8 extra bits of precision
+  uint32_t t = (uint64_t)rel * 65536 / info->audioBytes;
+  uint8_t p = 0;
+  while (p < MP3_TOC_SIZE - 1 && ((uint32_t)info->toc[p + 1] << 8) <= t)
+    p++;
+  uint32_t a = (uint32_t)info->toc[p] << 8;
+  uint32_t b = (p < MP3_TOC_SIZE - 1) ? (uint32_t)info->toc[p + 1] << 8 : 65536;
+  uint32_t frac = (b > a && t > a) ? (uint64_t)(t - a) * 256 / (b - a) : 0; // 1/256 percent
+  return ((uint64_t)p * 256 + frac) * info->duration / (MP3_TOC_SIZE * 256);
+}
@@ -0,0 +1,70 @@
+/***************************************************
+mp3Frame
+
+MPEG audio frame header and Xing/VBRI seek table parsing.
+Plain C++ without Arduino dependencies so the same code
+runs on the player and in host tools.
+
+****************************************************/
+
+#ifndef MP3FRAME_H
+#define MP3FRAME_H
+
+#include <stdint.h>
+
+#define MP3_TOC_SIZE 100       // entries of the percent -> byte table
+#define MP3_MAX_FRAMELEN 1441  // longest layer III frame (320 kbps, 32 kHz, padded)
+
+struct mp3FrameHeader // decoded 4 byte frame header
+{
+  uint8_t  version;         // 1: MPEG1, 2: MPEG2, 3: MPEG2.5
+  uint8_t  layer;           // 1, 2 or 3
+  uint8_t  mono;            // 1 if single channel
+  uint16_t bitrate;         // kbit/s
+  uint16_t sampleRate;      // Hz
+  uint16_t samplesPerFrame; // samples per channel in one frame
+  uint16_t frameLen;        // bytes including header and padding
+};
+
+struct mp3SeekInfo // everything needed to map play time to file offsets
+{
+  uint32_t audioStart; // offset of the first frame
+  uint32_t audioBytes; // bytes from the first frame to the end of audio
+  uint32_t duration;   // play time in ms
+  uint16_t bitrate;    // kbit/s, average for VBR files
+  uint16_t sampleRate; // Hz
+  uint8_t  version;    // MPEG version of the first frame, used to validate syncs
+  uint8_t  layer;      // layer of the first frame, used to validate syncs
+  bool     hasToc;     // toc holds a Xing or VBRI table, otherwise CBR mapping
+  uint8_t  toc[MP3_TOC_SIZE]; // toc[p] * audioBytes / 256 is the offset of p percent
+};
+
+// reads len bytes at file offset pos, returns number of bytes read
+typedef int (*mp3Reader)(void *ctx, uint32_t pos, uint8_t *buf, uint16_t len);
+
+// decode a frame header, false if the 4 bytes are no valid header
+bool mp3ParseHeader(const uint8_t *p, mp3FrameHeader *h);
+
+// decode the header the VS1053 reports in HDAT1 (sync word) and HDAT0
+bool mp3ParseHdat(uint16_t hdat1, uint16_t hdat0, mp3FrameHeader *h);
+
+// size of an ID3v2 tag at the start of the file including header and footer, 0 if none
+uint32_t mp3ID3Size(const uint8_t *p);
+
+// find the first frame at or after from (searching limit bytes) whose successor is a valid frame too
+// ref (may be 0) restricts the match to the version, layer and sample rate of a known frame
+// returns the offset or -1
+int32_t mp3FindFrame(mp3Reader read, void *ctx, uint32_t from, uint16_t limit,
+                     const mp3SeekInfo *ref, mp3FrameHeader *h);
+
+// fill info from the first frame at or after start and its Xing/VBRI header
+bool mp3ReadSeekInfo(mp3Reader read, void *ctx, uint32_t start, uint32_t fileSize,
+                     mp3SeekInfo *info);
+
+// file offset for a play time in ms (not yet synchronized to a frame)
+uint32_t mp3TimeToOffset(const mp3SeekInfo *info, uint32_t ms);
+
+// play time in ms for a file offset
+uint32_t mp3OffsetToTime(const mp3SeekInfo *info, uint32_t offset);
+
+#endif // MP3FRAME_H
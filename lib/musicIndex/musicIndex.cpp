@@ -0,0 +1,426 @@
+/***************************************************
+musicIndex
+
+Reader and writer of the binary library index on the
+SD card, see musicIndexFormat.h for the layout.
+
+****************************************************/
+
+#include "musicIndex.h"
+#include <mp3Frame.h>
+
+bool musicIndex::begin()
+{
+  end();
+  _file = SD.open(MUSICINDEX_FILE, O_READ);
+  if (!_file)
+    return false;
+  if (!readRecord(0, &_header, sizeof(_header)) ||
+      memcmp(_header.magic, MUSICINDEX_MAGIC, 4) != 0 ||
+      _header.version != MUSICINDEX_VERSION)
+  {
+    _file.close();
+    return false;
+  }
+  _open = true;
+  return true;
+}
+
+void musicIndex::end()
+{
+  if (_file)
+    _file.close();
+  memset(&_header, 0, sizeof(_header));
+  _open = false;
+  _cacheFolder = MUSICINDEX_NONE; // folder ids are only valid for one index
+  _cacheDir.close();
+}
+
+bool musicIndex::readRecord(uint32_t pos, void *record, uint16_t len)
+{
+  return _file.seek(pos) && _file.read(record, len) == len;
+}
+
+bool musicIndex::readFolder(uint16_t folder, musicIndexFolder *record)
+{
+  if (!_open || folder >= _header.folderCount)
+    return false;
+  return readRecord(_header.folderTable + (uint32_t)folder * sizeof(musicIndexFolder),
+                    record, sizeof(musicIndexFolder));
+}
+
+bool musicIndex::readTrack(uint16_t track, musicIndexTrack *record)
+{
+  if (!_open || track >= _header.trackCount)
+    return false;
+  return readRecord(_header.trackTable + (uint32_t)track * sizeof(musicIndexTrack),
+                    record, sizeof(musicIndexTrack));
+}
+
+bool musicIndex::cacheFolder(uint16_t folder, uint8_t track)
+{
+  if (folder != _cacheFolder)
+  {
+    musicIndexFolder f;
+    _cacheFolder = MUSICINDEX_NONE;
+    _cacheDir.close();
+    if (!readFolder(folder, &f))
+      return false;
+    memcpy(_cachePath, f.path, sizeof(_cachePath));
+    _cacheFirstTrack = f.firstTrack;
+    _cacheTrackCnt = f.trackCnt;
+    _cacheFolder = folder;
+    _cacheCount = 0;
+  }
+  if (track < 1 || track > _cacheTrackCnt)
+    return false;
+
+  // one track back for previous, the rest ahead for next and gapless queueing
+  uint8_t start = (track > 1) ? track - 1 : 1;
+  uint8_t count = _cacheTrackCnt - start + 1;
+  if (count > MUSICINDEX_CACHETRACKS)
+    count = MUSICINDEX_CACHETRACKS;
+  _cacheCount = 0;
+  if (!readRecord(_header.trackTable + (uint32_t)(_cacheFirstTrack + start - 1) * sizeof(musicIndexTrack),
+                  _cacheTracks, count * sizeof(musicIndexTrack)))
+  {
+    return false;
+  }
+  _cacheStart = start;
+  _cacheCount = count;
+  return true;
+}
+
+FatFile *musicIndex::folderDir(uint16_t folder)
+{
+  if (folder != _cacheFolder && !cacheFolder(folder, 1))
+    return NULL;
+  if (!_cacheDir.isOpen())
+  {
+    _cacheDir = SD.open(_cachePath[0] ? _cachePath : "/");
+    if (!_cacheDir.isDirectory())
+    {
+      _cacheDir.close();
+      return NULL;
+    }
+  }
+  return &_cacheDir;
+}
+
+// record of a track from the window, loads the window on a miss, NULL if there is no such track
+const musicIndexTrack *musicIndex::cachedTrack(uint16_t folder, uint8_t track)
+{
+  if (folder != _cacheFolder || track < _cacheStart || track >= _cacheStart + _cacheCount)
+  {
+    cacheMisses++;
+    if (!cacheFolder(folder, track))
+      return NULL;
+  }
+  else
+  {
+    cacheHits++;
+  }
+  return &_cacheTracks[track - _cacheStart];
+}
+
+bool musicIndex::folderTrack(uint16_t folder, uint8_t track, musicIndexTrack *record)
+{
+  const musicIndexTrack *cached = cachedTrack(folder, track);
+
+  if (cached == NULL)
+    return false;
+  *record = *cached;
+  return true;
+}
+
+bool musicIndex::trackPath(uint16_t folder, uint8_t track, char *path, musicIndexTrack *record)
+{
+  const musicIndexTrack *cached = cachedTrack(folder, track);
+
+  if (cached == NULL)
+  {
+    path[0] = '\0';
+    return false;
+  }
+  if (record != NULL)
+    *record = *cached;
+  strcpy(path, _cachePath);
+  strcat(path, "/");
+  strcat(path, cached->sfn);
+  return true;
+}
+
+// true if a folder path is the one a tag stores as name
+static bool matchesTag(const char *path, const char *name)
+{
+  return strlen(path) > MUSICINDEX_TAGOFFSET &&
+         strncmp(path + MUSICINDEX_TAGOFFSET, name, MUSICINDEX_TAGLEN) == 0;
+}
+
+uint16_t musicIndex::findFolder(const char *name)
+{
+  musicIndexFolder f;
+  musicIndexSlot slot;
+
+  if (_header.hashSlots == 0)
+    return scanFolder(name); // index without hash table
+
+  uint32_t h = musicIndexHash(name);
+  uint16_t mask = _header.hashSlots - 1;
+  uint16_t i = h & mask;
+  // consecutive slots share a sector, so a probe sequence rarely needs a second read
+  for (uint16_t n = 0; n < _header.hashSlots; n++)
+  {
+    if (!readRecord(_header.hashTable + (uint32_t)i * sizeof(slot), &slot, sizeof(slot)) ||
+        slot.folder == MUSICINDEX_NONE)
+      break;
+    if (slot.check == (uint16_t)(h >> 16) && readFolder(slot.folder, &f) &&
+        matchesTag(f.path, name))
+      return slot.folder;
+    i = (i + 1) & mask;
+  }
+  return MUSICINDEX_NONE;
+}
+
+uint16_t musicIndex::scanFolder(const char *name)
+{
+  musicIndexFolder f;
+
+  for (uint16_t i = 0; i < _header.folderCount; i++)
+  {
+    if (!readFolder(i, &f))
+      break;
+    if (matchesTag(f.path, name))
+      return i;
+  }
+  return MUSICINDEX_NONE;
+}
+
+uint16_t musicIndex::findPath(const char *path, uint16_t hint)
+{
+  musicIndexFolder f;
+
+  for (uint16_t n = 0; n < _header.folderCount; n++)
+  {
+    uint16_t i = (hint + n) % _header.folderCount;
+    if (!readFolder(i, &f))
+      break;
+    if (strcmp(f.path, path) == 0)
+      return i;
+  }
+  return MUSICINDEX_NONE;
+}
+
+// append n bytes of value
+static bool writeFill(File *file, uint8_t value, uint32_t n)
+{
+  uint8_t fill[32];
+  memset(fill, value, sizeof(fill));
+  while (n > 0)
+  {
+    uint8_t len = (n > sizeof(fill)) ? sizeof(fill) : n;
+    if (file->write(fill, len) != len)
+      return false;
+    n -= len;
+  }
+  return true;
+}
+
+// pad the index to the next sector boundary
+static bool alignSector(File *file)
+{
+  uint16_t used = file->position() % MUSICINDEX_SECTOR;
+  return used == 0 || writeFill(file, 0, MUSICINDEX_SECTOR - used);
+}
+
+bool musicIndexWriter::begin(const char *path)
+{
+  memset(&_header, 0, sizeof(_header));
+  memcpy(_header.magic, MUSICINDEX_MAGIC, 4);
+  _header.version = MUSICINDEX_VERSION;
+  _header.trackTable = MUSICINDEX_SECTOR;
+  _firstTrack = 0;
+
+  _index = SD.open(path, O_RDWR | O_CREAT | O_TRUNC);
+  _folders = SD.open(MUSICINDEX_FOLDERTMP, O_RDWR | O_CREAT | O_TRUNC);
+  if (!_index || !_folders)
+    return false;
+  // header is written by finish(), an aborted index fails the magic check
+  return writeFill(&_index, 0, MUSICINDEX_SECTOR);
+}
+
+bool musicIndexWriter::resume(const char *path, const musicIndexHeader *header, uint16_t firstTrack)
+{
+  _header = *header;
+  _firstTrack = firstTrack;
+
+  _index = SD.open(path, O_RDWR);
+  _folders = SD.open(MUSICINDEX_FOLDERTMP, O_RDWR);
+  if (!_index || !_folders)
+    return false;
+  // records behind the saved counts were written after the last sync
+  uint32_t indexSize = _header.trackTable + (uint32_t)_header.trackCount * sizeof(musicIndexTrack);
+  uint32_t folderSize = (uint32_t)_header.folderCount * sizeof(musicIndexFolder);
+  if (_index.size() < indexSize || _folders.size() < folderSize)
+    return false;
+  return _index.truncate(indexSize) && _folders.truncate(folderSize) &&
+         _index.seek(indexSize) && _folders.seek(folderSize);
+}
+
+bool musicIndexWriter::addTrack(const musicIndexTrack *record)
+{
+  if (_header.trackCount == MUSICINDEX_NONE - 1)
+    return false; // track table full
+  if (_index.write((const uint8_t *)record, sizeof(*record)) != sizeof(*record))
+    return false;
+  _header.trackCount++;
+  return true;
+}
+
+// mp3Reader on a File
+static int readFile(void *file, uint32_t pos, uint8_t *buf, uint16_t len)
+{
+  File *f = (File *)file;
+  if (!f->seek(pos))
+    return 0;
+  return f->read(buf, len);
+}
+
+bool musicIndexWriter::addTrack(File *entry)
+{
+  musicIndexTrack record;
+  mp3SeekInfo info;
+  uint8_t id3[10];
+
+  memset(&record, 0, sizeof(record));
+  entry->getSFN(record.sfn);
+  record.dirIndex = entry->dirIndex();
+  record.size = entry->size();
+  record.flags = MUSICINDEX_TRACK_PROBED;
+  // ID3v2 size, then the first frame and its Xing/VBRI header
+  if (mp3ReadSeekInfo(readFile, entry, 0, record.size, &info))
+  {
+    record.audioStart = info.audioStart;
+    record.bitrate = info.bitrate;
+    record.sampleRate = info.sampleRate;
+    record.duration = info.duration;
+  }
+  else if (readFile(entry, 0, id3, sizeof(id3)) == sizeof(id3))
+  {
+    record.audioStart = mp3ID3Size(id3); // no frame found, just skip the tag
+  }
+  return addTrack(&record);
+}
+
+bool musicIndexWriter::addFolder(const char *path, uint16_t entries, uint32_t stamp)
+{
+  musicIndexFolder record;
+  uint16_t trackCnt = _header.trackCount - _firstTrack;
+
+  if (trackCnt == 0)
+    return true; // only folders with tracks are indexed
+  memset(&record, 0, sizeof(record));
+  strncpy(record.path, path, MUSICINDEX_PATHLEN - 1);
+  record.firstTrack = _firstTrack;
+  record.trackCnt = trackCnt;
+  record.entries = entries;
+  record.stamp = stamp;
+  _firstTrack = _header.trackCount;
+
+  if (_folders.write((uint8_t *)&record, sizeof(record)) != sizeof(record))
+    return false;
+  _header.folderCount++;
+  return true;
+}
+
+bool musicIndexWriter::sync()
+{
+  return _index.sync() && _folders.sync();
+}
+
+void musicIndexWriter::end()
+{
+  _index.close();
+  _folders.close();
+}
+
+bool musicIndexWriter::finish()
+{
+  musicIndexFolder record;
+  bool ok = true;
+
+  // folder table follows the track table on the next sector
+  ok = alignSector(&_index);
+  _header.folderTable = _index.position();
+
+  _folders.seek(0);
+  for (uint16_t i = 0; ok && i < _header.folderCount; i++)
+  {
+    ok = _folders.read(&record, sizeof(record)) == sizeof(record) &&
+         _index.write((uint8_t *)&record, sizeof(record)) == sizeof(record);
+  }
+  _folders.close();
+  SD.remove(MUSICINDEX_FOLDERTMP);
+
+  if (ok)
+    ok = writeHash();
+  if (ok)
+  {
+    _index.seek(0);
+    ok = _index.write((uint8_t *)&_header, sizeof(_header)) == sizeof(_header);
+  }
+  _index.close();
+  return ok;
+}
+
+// hash table over the tag paths of all folders, behind the folder table
+bool musicIndexWriter::writeHash()
+{
+  musicIndexFolder record;
+  musicIndexSlot slot;
+
+  // at most half full, at least one sector
+  uint32_t slots = MUSICINDEX_SECTOR / sizeof(musicIndexSlot);
+  while (slots < 2UL * _header.folderCount)
+    slots <<= 1;
+  if (slots > 0x8000)
+    return true; // too many folders, lookups fall back to a scan
+
+  if (!alignSector(&_index))
+    return false;
+  _header.hashTable = _index.position();
+  _header.hashSlots = slots;
+  if (!writeFill(&_index, 0xFF, slots * sizeof(slot))) // all slots MUSICINDEX_NONE
+    return false;
+
+  uint16_t mask = slots - 1;
+  for (uint16_t f = 0; f < _header.folderCount; f++)
+  {
+    _index.seek(_header.folderTable + (uint32_t)f * sizeof(record));
+    if (_index.read(&record, sizeof(record)) != sizeof(record))
+      return false;
+    if (strlen(record.path) <= MUSICINDEX_TAGOFFSET)
+      continue; // no tag can point to this folder
+
+    uint32_t h = musicIndexHash(record.path + MUSICINDEX_TAGOFFSET);
+    uint16_t i = h & mask;
+    while (true)
+    {
+      uint32_t pos = _header.hashTable + (uint32_t)i * sizeof(slot);
+      _index.seek(pos);
+      if (_index.read(&slot, sizeof(slot)) != sizeof(slot))
+        return false;
+      if (slot.folder == MUSICINDEX_NONE)
+      {
+        slot.folder = f;
+        slot.check = h >> 16;
+        _index.seek(pos);
+        if (_index.write((uint8_t *)&slot, sizeof(slot)) != sizeof(slot))
+          return false;
+        break;
+      }
+      i = (i + 1) & mask;
+    }
+  }
+  return true;
+}
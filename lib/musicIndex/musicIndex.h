@@ -0,0 +1,105 @@
+/***************************************************
+musicIndex
+
+Reader and writer of the binary library index on the
+SD card, see musicIndexFormat.h for the layout.
+
+****************************************************/
+
+#ifndef MUSICINDEX_H
+#define MUSICINDEX_H
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include "musicIndexFormat.h"
+
+extern SdFat SD;
+
+#define MUSICINDEX_FILE "/index.bin"     // the index
+#define MUSICINDEX_TMP "/index.tmp"       // index under construction
+#define MUSICINDEX_FOLDERTMP "/index.fld" // folder records while indexing
+#define MUSICINDEX_CACHETRACKS 8          // track records of the current folder held in RAM
+
+// random access to /index.bin, keeps the file open
+// folderTrack() and trackPath() serve the current folder from a window of
+// track records in RAM, so skipping within a folder needs no index reads
+class musicIndex
+{
+public:
+  bool begin();   // open the index and check its header
+  void end();
+  bool isOpen() { return _open; }
+  uint16_t folderCount() { return _header.folderCount; }
+  uint16_t trackCount() { return _header.trackCount; }
+
+  bool readFolder(uint16_t folder, musicIndexFolder *record);
+  bool readTrack(uint16_t track, musicIndexTrack *record);
+
+  // record of track (1 based) of a folder
+  bool folderTrack(uint16_t folder, uint8_t track, musicIndexTrack *record);
+
+  // full path of track (1 based) of a folder, path needs MUSICINDEX_PATHLEN + MUSICINDEX_SFNLEN bytes
+  bool trackPath(uint16_t folder, uint8_t track, char *path, musicIndexTrack *record = NULL);
+
+  // fill the cache with the window around track (1 based) of a folder, done on a miss anyway
+  bool cacheFolder(uint16_t folder, uint8_t track);
+  // directory of a folder, kept open while the folder is cached, for opening tracks by dirIndex
+  FatFile *folderDir(uint16_t folder);
+  uint16_t cacheHits = 0;   // track lookups served from RAM
+  uint16_t cacheMisses = 0; // track lookups that read the index
+
+  // folder a tag points to, name is the path stored on the tag, MUSICINDEX_NONE if none
+  uint16_t findFolder(const char *name);   // hash table lookup
+  uint16_t scanFolder(const char *name);   // linear search through the folder table
+
+  // folder with exactly this absolute path, starting the search at hint, MUSICINDEX_NONE if none
+  uint16_t findPath(const char *path, uint16_t hint = 0);
+
+private:
+  bool readRecord(uint32_t pos, void *record, uint16_t len);
+  const musicIndexTrack *cachedTrack(uint16_t folder, uint8_t track);
+
+  File _file;
+  musicIndexHeader _header;
+  bool _open = false;
+
+  // window of the current folder
+  uint16_t _cacheFolder = MUSICINDEX_NONE;
+  char _cachePath[MUSICINDEX_PATHLEN];
+  uint16_t _cacheFirstTrack;  // track table index of the first track of the folder
+  uint8_t _cacheTrackCnt;     // tracks of the folder
+  uint8_t _cacheStart;        // track number (1 based) of _cacheTracks[0]
+  uint8_t _cacheCount;        // valid records in _cacheTracks
+  musicIndexTrack _cacheTracks[MUSICINDEX_CACHETRACKS];
+  File _cacheDir;              // directory of the cached folder, opened on demand
+};
+
+// builds an index while the card is walked folder by folder
+class musicIndexWriter
+{
+public:
+  bool begin(const char *path = MUSICINDEX_FILE); // create an empty index
+  // continue an index of which header and firstTrack were saved, drops everything written later
+  bool resume(const char *path, const musicIndexHeader *header, uint16_t firstTrack);
+  bool addTrack(File *entry);        // append an audio file of the current folder
+  bool addTrack(const musicIndexTrack *record); // append a record taken from another index
+  // close the current folder, absolute path, entries and stamp for change detection
+  bool addFolder(const char *path, uint16_t entries = 0, uint32_t stamp = 0);
+  bool sync();                       // flush everything added so far to the card
+  bool finish();                     // write folder table, hash table and header
+  void end();                        // abandon the index
+  uint16_t folderCount() { return _header.folderCount; }
+  uint16_t trackCount() { return _header.trackCount; }
+  const musicIndexHeader *header() { return &_header; }
+  uint16_t firstTrack() { return _firstTrack; }
+
+private:
+  File _index;
+  File _folders;
+  bool writeHash();
+
+  musicIndexHeader _header;
+  uint16_t _firstTrack;              // first track of the current folder
+};
+
+#endif // MUSICINDEX_H
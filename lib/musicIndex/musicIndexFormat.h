@@ -0,0 +1,131 @@
+/***************************************************
+musicIndexFormat
+
+Layout of the binary library index /index.bin.
+Plain C++ without Arduino dependencies so host tools
+can read and write the same file.
+
+  sector 0        header, rest zero
+  sector 1 ...    track table, 32 byte records, 16 per sector
+  next sector ... folder table, 64 byte records, 8 per sector
+  next sector ... folder hash table, 4 byte slots, 128 per sector
+
+The tracks of a folder are contiguous in the track table,
+so (folder, track) resolves to one record without a scan.
+The hash table maps the path stored on a tag to its folder
+with open addressing and linear probing.
+All numbers are little endian, the byte order of the AVR.
+
+****************************************************/
+
+#ifndef MUSICINDEXFORMAT_H
+#define MUSICINDEXFORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define MUSICINDEX_MAGIC "AIDX"  // first 4 bytes of the file
+#define MUSICINDEX_VERSION 1     // bumped on every incompatible change
+#define MUSICINDEX_SECTOR 512    // tables start on sector boundaries
+#define MUSICINDEX_PATHLEN 50    // folder path including the terminating 0
+#define MUSICINDEX_SFNLEN 13     // 8.3 name including the terminating 0
+#define MUSICINDEX_NONE 0xFFFF   // no folder/track
+#define MUSICINDEX_TAGOFFSET 7   // tags store the folder path from this offset on
+#define MUSICINDEX_TAGLEN 28     // and at most this many characters
+#define MUSICINDEX_DEPTH 8       // folder levels including the root that are indexed
+#define MUSICINDEX_HASHBASIS 2166136261UL // FNV-1a offset basis
+
+#define MUSICINDEX_TRACK_PROBED 0x01 // musicIndexTrack flag: audio data was parsed, see below
+
+struct musicIndexHeader // 32 bytes at offset 0
+{
+  char     magic[4];     // MUSICINDEX_MAGIC, not 0 terminated
+  uint16_t version;      // MUSICINDEX_VERSION
+  uint16_t folderCount;  // records in the folder table
+  uint16_t trackCount;   // records in the track table
+  uint16_t flags;        // reserved, 0
+  uint32_t trackTable;   // file offset of the track table
+  uint32_t folderTable;  // file offset of the folder table
+  uint32_t hashTable;    // file offset of the folder hash table, 0 if none
+  uint16_t hashSlots;    // slots of the folder hash table, a power of two
+  uint8_t  reserved[6];
+};
+
+struct musicIndexTrack // 32 bytes
+{
+  char     sfn[MUSICINDEX_SFNLEN]; // 8.3 file name
+  uint8_t  flags;       // MUSICINDEX_TRACK_PROBED if the fields below come from the audio data
+  uint16_t dirIndex;    // entry index within the folder, for open by index
+  uint32_t size;        // file size in bytes
+  uint32_t audioStart;  // offset of the first frame, behind the ID3v2 tag
+  uint16_t bitrate;     // kbit/s, average for VBR files, 0 if unknown
+  uint16_t sampleRate;  // Hz, 0 if unknown
+  uint32_t duration;    // play time in ms, 0 if unknown
+};
+
+struct musicIndexFolder // 64 bytes
+{
+  char     path[MUSICINDEX_PATHLEN]; // absolute path, empty for the root
+  uint16_t firstTrack;  // track table index of the first track
+  uint16_t trackCnt;    // number of tracks
+  uint16_t entries;     // directory entries when indexed, to detect changes
+  uint32_t stamp;       // hash over names, sizes and modification times of the entries
+  uint8_t  reserved[4];
+};
+
+struct musicIndexSlot // 4 bytes
+{
+  uint16_t folder;      // folder id, MUSICINDEX_NONE if the slot is empty
+  uint16_t check;       // upper half of the key hash, skips most foreign folders unread
+};
+
+// FNV-1a hash step over n bytes
+inline uint32_t musicIndexHashBytes(uint32_t h, const uint8_t *p, uint8_t n)
+{
+  for (uint8_t i = 0; i < n; i++)
+  {
+    h ^= p[i];
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+// hash of a tag path, stops at the terminating 0 or MUSICINDEX_TAGLEN characters
+inline uint32_t musicIndexHash(const char *key)
+{
+  uint8_t n = 0;
+  while (n < MUSICINDEX_TAGLEN && key[n])
+    n++;
+  return musicIndexHashBytes(MUSICINDEX_HASHBASIS, (const uint8_t *)key, n);
+}
+
+// fold name, size and modification time of a raw 32 byte directory entry into a folder stamp
+inline uint32_t musicIndexStamp(uint32_t h, const uint8_t *entry)
+{
+  h = musicIndexHashBytes(h, entry, 11);      // name
+  h = musicIndexHashBytes(h, entry + 28, 4);  // size
+  h = musicIndexHashBytes(h, entry + 24, 2);  // write date
+  return musicIndexHashBytes(h, entry + 22, 2); // write time
+}
+
+// true for the files listed as tracks, sfn as SdFat's getSFN() returns it
+inline bool musicIndexIsTrack(const char *sfn)
+{
+  return strstr(sfn, ".MP3") || strstr(sfn, ".mp3");
+}
+
+// play time at a file offset of a track, exact for CBR, an estimate for VBR files
+inline uint32_t musicIndexMillis(const musicIndexTrack *track, uint32_t offset)
+{
+  if (track->bitrate == 0 || offset <= track->audioStart)
+    return 0;
+  uint32_t ms = (uint64_t)(offset - track->audioStart) * 8 / track->bitrate;
+  return (track->duration && ms > track->duration) ? track->duration : ms;
+}
+
+static_assert(sizeof(musicIndexHeader) == 32, "musicIndexHeader layout");
+static_assert(sizeof(musicIndexTrack) == 32, "musicIndexTrack layout");
+static_assert(sizeof(musicIndexFolder) == 64, "musicIndexFolder layout");
+static_assert(sizeof(musicIndexSlot) == 4, "musicIndexSlot layout");
+
+#endif // MUSICINDEXFORMAT_H
@@ -0,0 +1,283 @@
+/***************************************************
+musicIndexer
+
+Builds the library index in small time slices while
+the player is idle, see musicIndexer.h.
+
+****************************************************/
+
+#include "musicIndexer.h"
+
+bool musicIndexer::begin(musicIndex *current, bool full)
+{
+  _old = current;
+  _writer.end();
+  _dir.close();
+  _state = idle;
+
+  // continue an unfinished index
+  File f = SD.open(MUSICINDEX_CHECKPOINT, O_READ);
+  if (f)
+  {
+    bool ok = !full && f.read(&_cp, sizeof(_cp)) == sizeof(_cp) &&
+              memcmp(_cp.magic, MUSICINDEX_MAGIC, 4) == 0;
+    f.close();
+    if (ok && _cp.depth == 0 && SD.exists(MUSICINDEX_TMP))
+    {
+      _state = ready; // power cut between finishing and installing
+      return true;
+    }
+    if (ok && _cp.depth > 0 &&
+        _writer.resume(MUSICINDEX_TMP, &_cp.header, _cp.firstTrack) && openDir())
+    {
+      _state = walking;
+      _lastCheckpoint = millis();
+      return true;
+    }
+    _writer.end();
+    SD.remove(MUSICINDEX_CHECKPOINT);
+  }
+
+  // new walk from the root
+  memset(&_cp, 0, sizeof(_cp));
+  memcpy(_cp.magic, MUSICINDEX_MAGIC, 4);
+  _cp.full = full || !_old->isOpen();
+  _cp.depth = 1;
+  _cp.stack[0].phase = countEntries;
+  _cp.stamp = MUSICINDEX_HASHBASIS;
+  if (!_writer.begin(MUSICINDEX_TMP) || !openDir())
+  {
+    fail();
+    return false;
+  }
+  _state = walking;
+  saveCheckpoint();
+  return true;
+}
+
+bool musicIndexer::step(uint16_t ms)
+{
+  uint32_t start = millis();
+  while (_state == walking && millis() - start < ms)
+  {
+    if (!stepOnce())
+    {
+      fail();
+      return false;
+    }
+  }
+  if (_state == walking && millis() - _lastCheckpoint >= MUSICINDEXER_CHECKPOINTTIME)
+    saveCheckpoint();
+  return _state == ready;
+}
+
+bool musicIndexer::install()
+{
+  if (_state != ready)
+    return false;
+  _state = idle;
+
+  // unchanged folders were all found in the same place, keep the old file
+  bool changed = _cp.full || _cp.changed != 0 || !_old->isOpen() ||
+                 _cp.header.folderCount != _old->folderCount();
+  if (changed)
+  {
+    _old->end();
+    SD.remove(MUSICINDEX_FILE);
+    SD.rename(MUSICINDEX_TMP, MUSICINDEX_FILE);
+  }
+  else
+  {
+    SD.remove(MUSICINDEX_TMP);
+  }
+  SD.remove(MUSICINDEX_CHECKPOINT);
+  _old->begin();
+  return changed;
+}
+
+// one directory entry or one copied track
+bool musicIndexer::stepOnce()
+{
+  musicIndexerFrame *frame = &_cp.stack[_cp.depth - 1];
+
+  switch (frame->phase)
+  {
+  case countEntries:
+  {
+    dir_t d;
+    if (_dir.readDir(&d) > 0)
+    {
+      _cp.entries++;
+      _cp.stamp = musicIndexStamp(_cp.stamp, (const uint8_t *)&d);
+      return true;
+    }
+    endCount();
+    _dir.rewindDirectory();
+    return true;
+  }
+
+  case copyTracks:
+  {
+    if (_cp.copied < _cp.oldCnt)
+    {
+      musicIndexTrack record;
+      if (!_old->readTrack(_cp.oldFirst + _cp.copied, &record) || !_writer.addTrack(&record))
+        return false;
+      _cp.copied++;
+      return true;
+    }
+    frame->phase = enterFolders;
+    _dir.rewindDirectory();
+    return _writer.addFolder(_cp.path, _cp.entries, _cp.stamp);
+  }
+
+  case scanTracks:
+  {
+    File entry = _dir.openNextFile();
+    if (!entry)
+    {
+      uint16_t folders = _writer.folderCount();
+      if (!_writer.addFolder(_cp.path, _cp.entries, _cp.stamp))
+        return false;
+      if (_writer.folderCount() != folders || _cp.oldFirst != MUSICINDEX_NONE)
+        _cp.changed++; // new, changed or removed tracks
+      frame->phase = enterFolders;
+      _dir.rewindDirectory();
+      return true;
+    }
+    char fname[MUSICINDEX_SFNLEN];
+    entry.getSFN(fname);
+    bool ok = entry.isDirectory() || !musicIndexIsTrack(fname) || _writer.addTrack(&entry);
+    entry.close();
+    return ok;
+  }
+
+  default: // enterFolders
+  {
+    File entry = _dir.openNextFile();
+    if (!entry)
+      return pop();
+    if (entry.isDirectory())
+    {
+      frame->entry = _dir.position() / sizeof(dir_t);
+      return push(&entry);
+    }
+    entry.close();
+    return true;
+  }
+  }
+}
+
+// compare the counted folder with its record in the old index
+void musicIndexer::endCount()
+{
+  musicIndexerFrame *frame = &_cp.stack[_cp.depth - 1];
+  musicIndexFolder old;
+  uint16_t id = MUSICINDEX_NONE;
+
+  if (!_cp.full)
+    id = _old->findPath(_cp.path, _cp.oldCursor); // usually the one behind the last match
+  // tracks indexed before metadata was stored are probed again
+  musicIndexTrack first;
+  if (id != MUSICINDEX_NONE && _old->readFolder(id, &old) &&
+      _old->readTrack(old.firstTrack, &first) && (first.flags & MUSICINDEX_TRACK_PROBED))
+  {
+    _cp.oldCursor = id + 1;
+    _cp.oldFirst = old.firstTrack;
+    _cp.oldCnt = old.trackCnt;
+  }
+  else
+  {
+    _cp.oldFirst = MUSICINDEX_NONE;
+    _cp.oldCnt = 0;
+  }
+  _cp.copied = 0;
+
+  if (_cp.oldFirst != MUSICINDEX_NONE && old.entries == _cp.entries && old.stamp == _cp.stamp)
+    frame->phase = copyTracks;
+  else
+    frame->phase = scanTracks;
+}
+
+// make a subdirectory the current one, entry is taken over
+bool musicIndexer::push(File *entry)
+{
+  char fname[MUSICINDEX_SFNLEN];
+  uint8_t len = strlen(_cp.path);
+
+  entry->getSFN(fname);
+  if (_cp.depth == MUSICINDEX_DEPTH || len + 1 + strlen(fname) >= MUSICINDEX_PATHLEN)
+  {
+    entry->close(); // too deep or path too long, not indexed
+    return true;
+  }
+  _cp.path[len] = '/';
+  strcpy(_cp.path + len + 1, fname);
+  _dir.close();
+  _dir = *entry;
+
+  musicIndexerFrame *frame = &_cp.stack[_cp.depth++];
+  frame->entry = 0;
+  frame->phase = countEntries;
+  _cp.entries = 0;
+  _cp.stamp = MUSICINDEX_HASHBASIS;
+  return true;
+}
+
+// back to the parent directory, finishes the index at the root
+bool musicIndexer::pop()
+{
+  _dir.close();
+  if (--_cp.depth == 0)
+  {
+    if (!_writer.finish())
+      return false;
+    saveCheckpoint();
+    _state = ready;
+    return true;
+  }
+  char *slash = strrchr(_cp.path, '/');
+  if (slash)
+    *slash = '\0';
+  return openDir();
+}
+
+// open the directory of the top frame at its saved entry
+bool musicIndexer::openDir()
+{
+  _dir = SD.open(_cp.path[0] ? _cp.path : "/");
+  if (!_dir || !_dir.isDirectory())
+    return false;
+  return _dir.seek((uint32_t)_cp.stack[_cp.depth - 1].entry * sizeof(dir_t));
+}
+
+void musicIndexer::saveCheckpoint()
+{
+  if (_cp.depth)
+  {
+    // everything the checkpoint counts has to be on the card first
+    _cp.stack[_cp.depth - 1].entry = _dir.position() / sizeof(dir_t);
+    if (!_writer.sync())
+      return;
+  }
+  _cp.header = *_writer.header();
+  _cp.firstTrack = _writer.firstTrack();
+
+  File f = SD.open(MUSICINDEX_CHECKPOINT, O_RDWR | O_CREAT | O_TRUNC);
+  if (f)
+  {
+    f.write((uint8_t *)&_cp, sizeof(_cp));
+    f.close();
+  }
+  _lastCheckpoint = millis();
+}
+
+void musicIndexer::fail()
+{
+  _writer.end();
+  _dir.close();
+  _state = idle;
+  SD.remove(MUSICINDEX_CHECKPOINT);
+  SD.remove(MUSICINDEX_TMP);
+  SD.remove(MUSICINDEX_FOLDERTMP);
+}
@@ -0,0 +1,98 @@
+/***************************************************
+musicIndexer
+
+Builds the library index in small time slices while
+the player is idle. The walk keeps an explicit stack
+of directory positions instead of recursing, saves a
+checkpoint regularly to survive a power cut, and only
+rescans folders whose entries changed since the last
+index. Unchanged folders are copied from it.
+
+The new index is written to /index.tmp and replaces
+/index.bin in install().
+
+****************************************************/
+
+#ifndef MUSICINDEXER_H
+#define MUSICINDEXER_H
+
+#include "musicIndex.h"
+
+#define MUSICINDEX_CHECKPOINT "/index.chk" // progress of an unfinished index
+#define MUSICINDEXER_CHECKPOINTTIME 5000   // ms between checkpoints
+
+struct musicIndexerFrame // position in one directory of the walk
+{
+  uint16_t entry; // next directory entry to look at
+  uint8_t  phase; // musicIndexer::phase
+  uint8_t  reserved;
+};
+
+struct musicIndexerCheckpoint // everything needed to continue the walk
+{
+  char     magic[4];       // MUSICINDEX_MAGIC
+  uint8_t  full;           // rescan every folder
+  uint8_t  depth;          // frames in use, 0 if the walk is complete
+  uint16_t entries;        // entries counted in the current folder
+  uint32_t stamp;          // stamp of the entries counted so far
+  uint16_t oldFirst;       // unchanged folder: its tracks in the old index
+  uint16_t oldCnt;
+  uint16_t copied;         // tracks of the unchanged folder copied so far
+  uint16_t changed;        // folders rescanned so far
+  uint16_t oldCursor;      // where the next folder is expected in the old index
+  uint16_t firstTrack;     // musicIndexWriter state
+  musicIndexHeader header;
+  musicIndexerFrame stack[MUSICINDEX_DEPTH];
+  char     path[MUSICINDEX_PATHLEN];
+};
+
+class musicIndexer
+{
+public:
+  // start a walk, or continue the one of the checkpoint, full ignores the current index
+  bool begin(musicIndex *current, bool full = false);
+  bool busy() { return _state != idle; } // walking or waiting for install()
+
+  // work for about ms, returns true once the new index is ready for install()
+  bool step(uint16_t ms);
+
+  // replace the current index by the new one, false if nothing changed and the old one is kept
+  bool install();
+
+  uint16_t folderCount() { return _writer.folderCount(); }
+  uint16_t trackCount() { return _writer.trackCount(); }
+  uint16_t changedFolders() { return _cp.changed; }
+
+  enum phase
+  {
+    countEntries, // count the entries and compare with the old index
+    copyTracks,   // unchanged folder, copy its tracks from the old index
+    scanTracks,   // changed folder, add its audio files
+    enterFolders  // descend into the subdirectories
+  };
+
+private:
+  enum state
+  {
+    idle,
+    walking,
+    ready
+  };
+
+  bool stepOnce();
+  bool push(File *entry);
+  bool pop();
+  bool openDir();
+  void endCount();
+  void saveCheckpoint();
+  void fail();
+
+  musicIndex *_old;
+  musicIndexWriter _writer;
+  musicIndexerCheckpoint _cp;
+  File _dir;
+  state _state = idle;
+  uint32_t _lastCheckpoint;
+};
+
+#endif // MUSICINDEXER_H
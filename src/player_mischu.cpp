@@ -8,19 +8,18 @@ MischuS
 //TODO: Relative Lautstärke auf TAG
 //TODO: play handling if single track selected
 //TODO: end by setting current track to 0 and check status
-//TODO: fast forward fast backward
 
 // include SPI, MP3, Buttons and SDfat libraries
 #include <Arduino.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include <SPI.h>
-#include <AdaMisch_VS1053.h>
+#include <AdaMisch_VS1053Driver.h>
 #include <SdFat.h>
 #include <JC_Button.h>
-#include <sdios.h>
 #include <MD_MAX72xx.h>
 #include <MFRC522.h>
+#include <musicIndexer.h>
 #include "user_fonts.h" // add user defined fonts for LED Matrix
 
 // Definitions for LED Matrix
@@ -77,6 +76,24 @@ bool newMessageAvailable = true;
 // define behaviour of buttons
 #define LONG_PRESS 1000
 
+// define fast forward/backward behaviour
+#define SEEK_STEP 10      // seconds per step
+#define SEEK_STEPTIME 300 // ms between steps while the button is held
+#define RESUME_REWIND 3   // seconds to repeat when resuming a track
+#define RESUME_MIN_LEFT 5 // seconds a resumed track needs left, otherwise the next one starts
+
+// define gapless behaviour
+#define QUEUE_RETRY 2000  // ms until a failed open of the next track is tried again
+
+// define audio book speed of play mode 5, the tag stores it in SPEED_STEP units
+#define SPEED_STEP 10  // percent per up/down press in the setup menu
+#define SPEED_MIN 70   // percent
+#define SPEED_MAX 250  // percent
+#define SPEED_SWEEP 3000 // ms per speed of the feed rate sweep
+
+// VS1053b patches package in plugin format, loaded at boot if present
+#define PATCH_FILE "/PATCHES.053"
+
 // define volume behavior and limits
 #define VOLUME_MAX 25
 #define VOLUME_MIN 97
@@ -84,6 +101,9 @@ bool newMessageAvailable = true;
 #define VOLUME_STEP 3
 #define VOLUME_STEPTIME 150
 
+// define indexing behaviour
+#define INDEX_SLICE 20 // ms of indexing per loop pass while idle
+
 // define sleep behaviour
 #define MAX_IDLECNT  1000
 //#define SLEEP_TIME  500
@@ -102,10 +122,11 @@ struct playInfo // struct with essential infos about a tag
 {
   uint32_t uid = 0;             // first four bytes of the tags uid
   uint8_t  mode = 1;            // play mode
-  uint16_t pathLine = 0;        // line number of the current play path in the index file
+  uint16_t folder = MUSICINDEX_NONE; // folder of the current play path in the index file
   uint8_t  trackCnt = 0;        // track count of the folder
   uint8_t  currentTrack = 1;    // current track, 0 if ended playing
   uint32_t playPos = 0;         // last position within file when removed tag
+  uint16_t speed = 100;         // play speed in percent, set by audio book tags (mode 5)
 };
 
 // init and end functions
@@ -115,6 +136,7 @@ bool endNFCReader();
 bool initPlayer();
 bool endPlayer();
 bool initSD();
+void loadPatches();                                         // load the decoder patches package, prints the load time
 bool endSD();
 bool initButtons();
 bool endButtons();
@@ -122,16 +144,19 @@ bool initLEDArray(bool animation = false);
 bool endLEDArray();
 
 // function definition
-void indexDirectoryToFile(File dir, File *indexFile);
 int voiceMenu(playInfo playInfoList[], int option);         // voice menu for setting up device
 void resetCard();                                           // resets a card
 int setupCard(nfcTagData *nfcData, playInfo playInfoList[]); // first time setup of a card
 bool readCard(nfcTagData *dataIn);                          // reads card content and save it in nfcTagObject
 bool writeCard(nfcTagData *dataOut);                        // writes card content from nfcTagObject
-uint16_t findLine(nfcTagData *tagData);                     // find line in index file corresponding to the path saved on the tag
+uint16_t findFolder(nfcTagData *tagData);                   // find folder in index file corresponding to the path saved on the tag
 void selectPlayFolder(playInfo playInfoList[], uint8_t foldernum);
 void playMenuOption(int option);
 void startPlaying(playInfo playInfoList[]);   // start playing selected track
+bool getTrackPath(playInfo playInfoList[], uint8_t track, char *path, musicIndexTrack *record = NULL); // full path and index record of a track of the current folder
+void showTrackNumber(uint8_t track);          // show track number on LED display
+void queueNext(playInfo playInfoList[]);      // open next track ahead of time for gapless playback
+void benchmarkOpen();                         // open latency by path and by directory entry
 bool selectNext(playInfo playInfoList[]);     // selects next track
 void selectPrevious(playInfo playInfoList[]); // selects previous track
 void printerror(int errorcode, int source);
@@ -144,11 +169,20 @@ void lowBattery();
 void goToSleep();
 void wakeup();
 void waitWhite();
+void waitFeeding(uint16_t ms); // delay while keeping the audio ring filled
+VS1053_PlayerStatus playerStatus(); // consistent copy of the player state, the feeder interrupt changes it any time
+uint32_t audioStart(musicIndexTrack *record); // start offset for the player from an index record
+void printMillis(uint32_t ms);  // print play time as m:ss
+void printReadStats(const __FlashStringHelper *path, VS1053_ReadStats *stats); // throughput and latency of a read path
+void printTelemetry();                                      // playback health: starvation, feed times, feed rate vs bitrate
+void speedSweep();                                          // feed rate and underruns at each play speed
+void installIndex(playInfo playInfoList[]); // switch to a new library index, keeps the recent list
+bool seekStep(int16_t seconds); // fast forward/backward step, false at the end of the track
 
 
 // instanciate global objects
-// create instance of musicPlayer object
-Adafruit_VS1053_FilePlayer musicPlayer = Adafruit_VS1053_FilePlayer(SHIELD_RESET, SHIELD_CS, SHIELD_DCS, DREQ, CARDCS);
+// create instance of musicPlayer object, pins are resolved at compile time
+VS1053Driver<SHIELD_CS, SHIELD_DCS, DREQ, CARDCS> musicPlayer(SHIELD_RESET);
 
 // create instance of card reader
 MFRC522 mfrc522(SS_PIN, RST_PIN); // create instance of MFRC522 object
@@ -158,8 +192,10 @@ MD_MAX72XX mx1 = MD_MAX72XX(HARDWARE_TYPE1, DATA_PIN, CLK_PIN, CS_PIN1, MAX_DEVI
 MD_MAX72XX mx2 = MD_MAX72XX(HARDWARE_TYPE2, DATA_PIN, CLK_PIN, CS_PIN2, MAX_DEVICES2);
 
 // objects for SD handling
-ifstream sdin; // input stream for searching in indexfile
-SdFat SD;      // file system object
+SdFat SD;                // file system object
+musicIndex libraryIndex; // random access to the folders and tracks on the SD card
+musicIndexer indexer;    // updates libraryIndex in the background
+musicIndexTrack trackInfo; // index record of the current track, duration and bitrate for progress and resume
 
 // Buttons
 Button uButton(blueButton);
@@ -174,6 +210,9 @@ bool tagStatus = false;          // tagStatus=true, tag is present, tagStatus=fa
 playInfo playInfoList[3];        // FIFO of recent holds 3 entries
 uint16_t idleCnt = 0;
 bool idleFlag = true;          // false means, doing stuff
+uint32_t audioWait = 0;        // micros() of the last startPlaying() until its first audio, 0 when reported
+bool queueWait = false;        // queueNext() failed for the current track, retried after queueTime + QUEUE_RETRY
+uint32_t queueTime = 0;        // millis() of the failed queueNext()
 
 // NFC management
 MFRC522::StatusCode status; // status code of MFRC522 operations
@@ -201,6 +240,7 @@ void setup()
   initNFCReader();
   initPlayer();
   initSD();
+  loadPatches();
   initLEDArray(true);
 
   /*------------------------
@@ -219,33 +259,16 @@ void setup()
   /*------------------------
   startup program
   ------------------------*/ 
-  // index SD card if left, middle and right button are pressed during startup
-  if (lButton.read() && mButton.read() && rButton.read())
+  // reindex SD card if left, middle and right button are pressed during startup
+  // otherwise continue an interrupted index or look for changed folders, both run while idle
+  bool fullIndex = lButton.read() && mButton.read() && rButton.read();
+  if (indexer.begin(&libraryIndex, fullIndex))
   {
-    
-    Serial.println(F("index "));
-
-    if (musicPlayer.playingMusic) // stop music player in order to avoid parallel access to SD card
-      musicPlayer.stopPlaying();
-
-    if (SD.exists("/index.txt")) // remove existing index file from SD card
-    {
-      SD.remove("/index.txt");
-    }
-    File indexfile = SD.open("/index.txt", FILE_WRITE); // open new indexfile on SD card
-    if (indexfile)
-    {
-      Serial.println(F("start"));
-    }
-    else
-    {
-      printerror(302, 0);
-    }
-    File root = SD.open("/");
-    indexDirectoryToFile(root, &indexfile);
-    indexfile.close();
-    Serial.println(F(" ok"));
-    root.close();
+    Serial.println(fullIndex ? F("index all") : F("index changes"));
+  }
+  else
+  {
+    printerror(302, 0);
   }
   Serial.println(F("start main loop"));
 }
@@ -264,13 +287,23 @@ void loop()
   static bool lButtonLong = false;
   nfcTagData dataIn;
 
+  // refill audio ring, SD card is only read from here and not from the DREQ interrupt
+  musicPlayer.feedRing();
+  VS1053_PlayerStatus player = playerStatus(); // one view of the player for the status handling
+  if (audioWait && player.state == VS1053_STATE_PLAYING)
+  {
+    Serial.print(F("first audio us: "));
+    Serial.println(micros() - audioWait);
+    audioWait = 0;
+  }
+
   /*------------------------
   player status handling
   ------------------------*/
-  if (!musicPlayer.playingMusic)
+  if (!player.playing())
   {
     idleFlag = true;
-    if(tagStatus && !musicPlayer.paused()) // tag is present but no music is playing play next track if possible
+    if(tagStatus && player.state == VS1053_STATE_STOPPED) // tag is present but no music is playing play next track if possible, after the tail of the last one
     {
       if(selectNext(playInfoList))
       {
@@ -288,16 +321,36 @@ void loop()
         // remove uid from play info list, reset complete entry
         playInfoList[0].uid = 0;
         playInfoList[0].mode = 1;
-        playInfoList[0].pathLine = 0;
+        playInfoList[0].folder = MUSICINDEX_NONE;
         playInfoList[0].trackCnt = 0;
         playInfoList[0].currentTrack = 1;
         playInfoList[0].playPos = 0;
+        playInfoList[0].speed = 100;
       }
     }
   }
   else
   {
     idleFlag = false;
+    if (tagStatus)
+    {
+      if (musicPlayer.queuedTrackStarted()) // player continued with the queued track
+      {
+        selectNext(playInfoList);
+        queueWait = false; // new current track, queue its successor right away
+        libraryIndex.folderTrack(playInfoList[0].folder, playInfoList[0].currentTrack, &trackInfo);
+        Serial.print(F("gapless next track: "));
+        Serial.println(playInfoList[0].currentTrack);
+        showTrackNumber(playInfoList[0].currentTrack);
+        Serial.print(F("switch us: "));
+        Serial.print(musicPlayer.lastSwitchMicros);
+        Serial.print(F(" underruns: "));
+        Serial.print(musicPlayer.lastSwitchUnderruns);
+        Serial.print(F(" gap us: "));
+        Serial.println(musicPlayer.lastGapMicros);
+      }
+      queueNext(playInfoList);
+    }
   }
 
   /*------------------------
@@ -327,7 +380,7 @@ void loop()
     }
     musicPlayer.setVolume(volume, volume);
     Serial.println(volume);
-    delay(VOLUME_STEPTIME); // delay the program execution not to step up volume too fast
+    waitFeeding(VOLUME_STEPTIME); // delay the program execution not to step up volume too fast
   }
   if (dButton.wasReleased() || dButton.pressedFor(LONG_PRESS)) //decrease volume
   {
@@ -339,7 +392,7 @@ void loop()
     }
     musicPlayer.setVolume(volume, volume);
     Serial.println(volume);
-    delay(VOLUME_STEPTIME); // delay the program execution not to step up volume too fast
+    waitFeeding(VOLUME_STEPTIME); // delay the program execution not to step up volume too fast
   }
 
   // left/right button handling for next track, previous track
@@ -348,8 +401,8 @@ void loop()
     // left button handling
     if (lButton.pressedFor(LONG_PRESS)) // fast backward
     {
-      Serial.println(F("fast backward"));
       lButtonLong = true;
+      seekStep(-SEEK_STEP);
     }
     if (lButton.wasReleased()) // previous track
     {
@@ -366,22 +419,14 @@ void loop()
     if (rButton.pressedFor(LONG_PRESS)) // fast forward
     {
       rButtonLong = true;
-      Serial.println(F("fast forward"));
-      Serial.print(F("file size: "));     Serial.println(musicPlayer.fileSize());
-      Serial.print(F("file position: ")); Serial.println(musicPlayer.filePosition());
-      long targetPosition = musicPlayer.filePosition() + (1024L * 256L);
-      Serial.print(F("target progress: ")); Serial.println(100L * musicPlayer.filePosition());
-      //if targetPosition*100 < musicPlayer.fileSize(){
-      musicPlayer.fileSeek(musicPlayer.filePosition() + (1024L * 256L));
-      //}
-      //else
-      //{
-       // if (selectNext(playInfoList))
-       // {
-       //   startPlaying(playInfoList);
-       // }
-      //}
-      
+      if (!seekStep(SEEK_STEP))
+      {
+        // end of track reached
+        if (selectNext(playInfoList))
+        {
+          startPlaying(playInfoList);
+        }
+      }
     }
     if (rButton.wasReleased()) // next track
     {
@@ -418,7 +463,7 @@ void loop()
     else
     {
       Serial.println(F("M short"));
-      if (!musicPlayer.paused())
+      if (playerStatus().state != VS1053_STATE_PAUSED)
       {
         sprintf(message,"=");
         printText(0, MAX_DEVICES1 - 1, message);
@@ -452,7 +497,110 @@ void loop()
     {
       Serial.println(F("current playInfoList"));
       printPlayInfoList(playInfoList);
+      Serial.print(F("ring underruns: "));
+      Serial.println(musicPlayer.ringUnderruns);
+      Serial.print(F("SD accesses while playing: "));
+      Serial.print(musicPlayer.busAccesses);
+      Serial.print(F(" underruns during them: "));
+      Serial.println(musicPlayer.busUnderruns);
+      Serial.print(F("decoder resets after cancel: "));
+      Serial.println(musicPlayer.cancelResets);
+      Serial.print(F("feeder collisions: "));
+      Serial.print(musicPlayer.feedCollisions);
+      Serial.print(F(" reruns: "));
+      Serial.println(musicPlayer.feedReruns);
+      Serial.print(F("max us interrupts off: "));
+      Serial.println(musicPlayer.irqOffMaxMicros);
+      printReadStats(F("raw"), &musicPlayer.rawReads);
+      printReadStats(F("file"), &musicPlayer.fileReads);
+      player = playerStatus();
+      if (player.playing())
+      {
+        Serial.print(F("progress: "));
+        printMillis(musicIndexMillis(&trackInfo, player.position));
+        Serial.print(F(" / "));
+        printMillis(trackInfo.duration);
+        Serial.println();
+      }
+    }
+    if (c == 't') // playback health telemetry
+    {
+      printTelemetry();
+    }
+    if (c == 'h') // switch between hybrid and pin change feeding, compare with 't'
+    {
+      static bool hybrid = true;
+      hybrid = !hybrid;
+      musicPlayer.useInterrupt(hybrid ? VS1053_FILEPLAYER_HYBRID_INT : VS1053_FILEPLAYER_PIN_INT);
+      Serial.println(hybrid ? F("feeder: hybrid") : F("feeder: pin change"));
+    }
+    if (c == 's') // feed rate and underruns at each play speed, needs a playing track
+    {
+      if (!musicPlayer.patchesActive())
+        Serial.println(F("no speed control without decoder patches"));
+      else if (playerStatus().playing())
+        speedSweep();
+      else
+        Serial.println(F("start playing first"));
+    }
+    if (c == 'b') // benchmark SDI and SCI transfers
+    {
+      if (playerStatus().state == VS1053_STATE_STOPPED)
+        musicPlayer.benchmarkSDI();
+      else
+        Serial.println(F("stop playing first"));
+      musicPlayer.benchmarkPins();
+      musicPlayer.benchmarkSCI();
+    }
+    if (c == 'i') // index lookup timing, last folder and track are the worst case of a scan
+    {
+      if (indexer.busy())
+      {
+        Serial.print(F("indexing, folders: "));
+        Serial.print(indexer.folderCount());
+        Serial.print(F(" changed: "));
+        Serial.println(indexer.changedFolders());
+      }
+      char buffer[MUSICINDEX_PATHLEN + MUSICINDEX_SFNLEN];
+      musicIndexFolder folder;
+      uint16_t last = libraryIndex.folderCount() - 1;
+      Serial.print(libraryIndex.folderCount());
+      Serial.print(F(" folders "));
+      Serial.print(libraryIndex.trackCount());
+      Serial.println(F(" tracks"));
+      uint16_t underruns = musicPlayer.busUnderruns;
+      musicPlayer.beginBusAccess();
+      if (libraryIndex.readFolder(last, &folder))
+      {
+        uint32_t t = micros();
+        libraryIndex.trackPath(last, folder.trackCnt, buffer);
+        t = micros() - t;
+        Serial.print(buffer);
+        Serial.print(F(" track lookup us: "));
+        Serial.println(t);
+        t = micros();
+        uint16_t found = libraryIndex.findFolder(folder.path + MUSICINDEX_TAGOFFSET);
+        t = micros() - t;
+        Serial.print(F("folder "));
+        Serial.print(found);
+        Serial.print(F(" hash us: "));
+        Serial.print(t);
+        t = micros();
+        libraryIndex.scanFolder(folder.path + MUSICINDEX_TAGOFFSET);
+        t = micros() - t;
+        Serial.print(F(" scan us: "));
+        Serial.println(t);
+      }
+      musicPlayer.endBusAccess();
+      Serial.print(F("underruns during lookups: "));
+      Serial.println(musicPlayer.busUnderruns - underruns);
+      Serial.print(F("track cache hits: "));
+      Serial.print(libraryIndex.cacheHits);
+      Serial.print(F(" misses: "));
+      Serial.println(libraryIndex.cacheMisses);
     }
+    if (c == 'o') // open latency against folder size
+      benchmarkOpen();
     if (c == 'k') // create key card
     {
       Serial.println(F("create new key card"));
@@ -496,6 +644,7 @@ void loop()
     tagStatus = newTagStatus;
     if (tagStatus) // nfc card added
     {
+      uint32_t tagTime = micros(); // tag placement to first audio latency
       Serial.print(F("tag detected: "));
       readCard(&dataIn);
       Serial.print(F("cookie: "));
@@ -525,7 +674,10 @@ void loop()
         if (!uidKnown)                                              //uid was not in playInfoList, lookup information and populate all required information in list
         {
           playInfoList[0].mode = dataIn.mode;
-          playInfoList[0].pathLine = findLine(&dataIn);
+          uint32_t lookupTime = micros();
+          playInfoList[0].folder = findFolder(&dataIn);
+          Serial.print(F("folder lookup us: "));
+          Serial.println(micros() - lookupTime);
           playInfoList[0].trackCnt = dataIn.trackCnt;
           if (dataIn.mode == 4)
           {
@@ -535,6 +687,14 @@ void loop()
           {
             playInfoList[0].currentTrack = 1;
           }
+          if (dataIn.mode == 5 && dataIn.special)
+          {
+            playInfoList[0].speed = dataIn.special * SPEED_STEP;
+          }
+          else
+          {
+            playInfoList[0].speed = 100;
+          }
           playInfoList[0].playPos = 0;
         }
         else // uid already existing in playInfoList use it
@@ -545,6 +705,8 @@ void loop()
         printPlayInfoList(playInfoList);
         Serial.println(F("start playing:"));
         startPlaying(playInfoList);
+        Serial.print(F("tag to audio us: "));
+        Serial.println(micros() - tagTime);
         idleFlag = false;
         Serial.println(F("end flag set to false"));
         break;
@@ -554,9 +716,11 @@ void loop()
     {
       Serial.println(F("tag removed"));
       // save current trackPos to recent list in order to resume correctly is the same tag is reapplied
-      if (musicPlayer.playingMusic || musicPlayer.paused())
+      player = playerStatus();
+      if (player.playing() || player.state == VS1053_STATE_PAUSED)
       {
         playInfoList[0].playPos = musicPlayer.stopPlaying(); // stop musicPlayer
+        musicPlayer.setPlaySpeed(100); // voice prompts at normal speed
         printPlayInfoList(playInfoList);
 
         idleFlag = true;
@@ -567,6 +731,16 @@ void loop()
     }
   }
   
+  /*------------------------
+  library index handling
+  ------------------------*/
+  if (idleFlag && indexer.busy())
+  {
+    idleCnt = 0; // don't sleep before the index is complete
+    if (indexer.step(INDEX_SLICE))
+      installIndex(playInfoList);
+  }
+
   /*------------------------
   sleep handling
   ------------------------*/
@@ -633,11 +807,32 @@ bool initPlayer()
   bool res = true;
   musicPlayer.begin();                                 // setup music player
   Serial.println(F("VS1053 ok"));                      // print music player info
+  Serial.print(F("SCI kHz: "));                        // control bus speed of the clock profile
+  Serial.println(musicPlayer.sciClock() / 1000);
   musicPlayer.setVolume(volume, volume);               // set volume for R and L chan, 0: loudest, 256: quietest
-  musicPlayer.useInterrupt(VS1053_FILEPLAYER_PIN_INT); // setup music player to use interupts
+  musicPlayer.setResumeRewind(RESUME_REWIND);          // repeat a few seconds when a track is resumed
+  musicPlayer.useRingBuffer(true);                     // SD card is read in main loop, DREQ interrupt only feeds the decoder
+  musicPlayer.useInterrupt(VS1053_FILEPLAYER_HYBRID_INT); // rising DREQ edge plus a slow timer tick for missed edges
   return  res;
 }
 
+void loadPatches()
+{
+  if (!SD.exists(PATCH_FILE))
+  {
+    Serial.println(F("no decoder patches"));
+    return;
+  }
+  uint32_t start = millis();
+  if (!musicPlayer.startPatches(PATCH_FILE)) // the driver reloads them after each decoder reset
+  {
+    printerror(202, 0);
+    return;
+  }
+  Serial.print(F("patch load ms: "));
+  Serial.println(millis() - start);
+}
+
 bool endPlayer()
 {
   bool res = true;
@@ -656,6 +851,8 @@ bool initSD()
   else
   {
     Serial.println(F("ok"));
+    if (!libraryIndex.begin()) // missing or outdated, hold left, middle and right button at startup to create it
+      printerror(303, 0);
   }
   return  res;
 }
@@ -732,8 +929,51 @@ void waitWhite()
     if(mButton.wasPressed())
       return;
     else
-      delay(50);
+      waitFeeding(50);
+  }
+}
+
+// delay which keeps refilling the audio ring, plain delay() would let it run dry
+void waitFeeding(uint16_t ms)
+{
+  uint32_t start = millis();
+  do
+  {
+    musicPlayer.feedRing();
+  } while (millis() - start < ms);
+}
+
+// the player's status in one piece, its fields may change between two separate reads
+VS1053_PlayerStatus playerStatus()
+{
+  VS1053_PlayerStatus s;
+  musicPlayer.status(&s);
+  return s;
+}
+
+// one fast forward/backward step, rate limited while the button is held
+bool seekStep(int16_t seconds)
+{
+  static unsigned long lastStep = 0;
+  if (millis() - lastStep < SEEK_STEPTIME)
+    return true;
+  lastStep = millis();
+
+  if (musicPlayer.seekSeconds(seconds))
+  {
+    VS1053_PlayerStatus player = playerStatus(); // position and size of the same moment
+    Serial.print(seconds > 0 ? F("fast forward ") : F("fast backward "));
+    Serial.print(musicPlayer.millisAt(player.position) / 1000);
+    Serial.print(F("s / "));
+    Serial.print(musicPlayer.durationMillis() / 1000);
+    Serial.print(F("s byte "));
+    Serial.print(player.position);
+    Serial.print(F(" / "));
+    Serial.println(player.size);
+    return true;
   }
+  // a forward step fails behind the end, otherwise the track has no seek info
+  return seconds < 0 || musicPlayer.durationMillis() == 0;
 }
 
 void goToSleep()
@@ -772,7 +1012,7 @@ int voiceMenu(playInfo playInfoList[], int option)
 
   Serial.print(F("voice menu"));
   Serial.println(option, DEC);
-  if (musicPlayer.playingMusic)
+  if (playerStatus().playing())
     musicPlayer.stopPlaying();
   
   switch (option) // explenation text
@@ -789,10 +1029,15 @@ int voiceMenu(playInfo playInfoList[], int option)
     if (!musicPlayer.startPlayingFile("/VOICE/0320_S~1.mp3"))
       printerror(201, 1);
     break;
+  case 4: // select audio book speed, the first track plays at the selected speed
+    returnValue = playInfoList[0].speed;
+    startPlaying(playInfoList);
+    break;
   }
 
   do
   {
+    musicPlayer.feedRing();
     mButton.read();
     rButton.read();
     lButton.read();
@@ -802,7 +1047,7 @@ int voiceMenu(playInfo playInfoList[], int option)
     // abort voice menu by long middle button
     if (mButton.pressedFor(LONG_PRESS))
     {
-      if (musicPlayer.playingMusic)
+      if (playerStatus().playing())
         musicPlayer.stopPlaying();
       return 0;
     }
@@ -810,7 +1055,7 @@ int voiceMenu(playInfo playInfoList[], int option)
     // exit voice menu by middle button
     if (mButton.wasPressed())
     {
-      if (musicPlayer.playingMusic)
+      if (playerStatus().playing())
         musicPlayer.stopPlaying();
       return returnValue;
     }
@@ -871,8 +1116,6 @@ int voiceMenu(playInfo playInfoList[], int option)
     case 3: // select track within folder
       if (uButton.wasPressed())
       {
-        if (musicPlayer.playingMusic)
-          musicPlayer.stopPlaying();
         if (returnValue == 0)
         {
           returnValue = 1;
@@ -904,6 +1147,21 @@ int voiceMenu(playInfo playInfoList[], int option)
         }
       }
       break;
+
+    case 4: // select audio book speed, changes apply while playing
+      if (uButton.wasPressed() && returnValue < SPEED_MAX)
+      {
+        returnValue += SPEED_STEP;
+        playInfoList[0].speed = musicPlayer.setPlaySpeed(returnValue);
+        Serial.println(returnValue);
+      }
+      if (dButton.wasPressed() && returnValue > SPEED_MIN)
+      {
+        returnValue -= SPEED_STEP;
+        playInfoList[0].speed = musicPlayer.setPlaySpeed(returnValue);
+        Serial.println(returnValue);
+      }
+      break;
     }
   } while (true);
 }
@@ -913,6 +1171,7 @@ void resetCard()
   nfcTagData emptyData = {0, "", 0, 0, 0};
   do
   {
+    musicPlayer.feedRing();
     lButton.read();
     uButton.read();
     dButton.read();
@@ -920,7 +1179,7 @@ void resetCard()
     if (uButton.wasReleased() || dButton.wasReleased())
     {
       Serial.print(F("abort"));
-      if (musicPlayer.playingMusic)
+      if (playerStatus().playing())
         musicPlayer.stopPlaying();
       if (!musicPlayer.startPlayingFile("/VOICE/0802_R~1.MP3"))
         printerror(201,0); 
@@ -932,7 +1191,7 @@ void resetCard()
   tagStatus = true;
   Serial.print(F("reset tag"));
   writeCard(&emptyData);
-  if (musicPlayer.playingMusic)
+  if (playerStatus().playing())
     musicPlayer.stopPlaying();
   if (!musicPlayer.startPlayingFile("/VOICE/0801_R~1.MP3"))
     printerror(201,0);
@@ -943,40 +1202,33 @@ int setupCard(nfcTagData *nfcData, playInfo playInfoList[])
   // variables for function
   int returnValue = 0;
   int result = 0;
-  char dirName[50];
 
   // STEP 1 select selectPlayFolder by voiceMenu
   result = voiceMenu(playInfoList, 1);
   if (result > 0) // copy selected folder to nfcData struct
   {
-    sdin.open("/index.txt"); // open indexfile on SD card
-    sdin.seekg(0);           // rewind filepointer to the start of the file
-    for (uint16_t i = 1; i < playInfoList[0].pathLine; i++) //go to path line
-    {
-      sdin.ignore(50, '\n');
-    }
-    sdin.getline(dirName, 50, '\n'); //copy pathname to buffer
-    sdin.close();
-    strtok(dirName, "\t");
-    Serial.println(dirName);
+    musicIndexFolder folder;
+    if (!libraryIndex.readFolder(playInfoList[0].folder, &folder)) // look up pathname of the folder
+      printerror(303, 0);
+    Serial.println(folder.path);
 
-    strncpy(nfcData->pname, dirName + 7, 28);
+    strncpy(nfcData->pname, folder.path + MUSICINDEX_TAGOFFSET, MUSICINDEX_TAGLEN);
     
     nfcData->trackCnt = playInfoList[0].trackCnt;
     
-    if (musicPlayer.playingMusic)
+    if (playerStatus().playing())
       musicPlayer.stopPlaying();
     if (!musicPlayer.startPlayingFile("/VOICE/0310_T~1.mp3"))
       printerror(201,0);
   }
   else // play error message and exit card setup
   {
-    if (musicPlayer.playingMusic)
+    if (playerStatus().playing())
       musicPlayer.stopPlaying();
     if (!musicPlayer.startPlayingFile("/VOICE/0401_E~1.mp3"))
       printerror(201,0);
     // read buttons before leaving in order to avoid button event when reentering main loop
-    delay(100);
+    waitFeeding(100);
     lButton.read();
     mButton.read();
     rButton.read();
@@ -993,6 +1245,7 @@ int setupCard(nfcTagData *nfcData, playInfo playInfoList[])
   {
     playInfoList[0].mode = result;
     playInfoList[0].currentTrack = 1;
+    playInfoList[0].speed = 100;
     nfcData->mode = result;
   }
   
@@ -1009,13 +1262,31 @@ int setupCard(nfcTagData *nfcData, playInfo playInfoList[])
       return returnValue;
     }
   }
+
+  if (result == 5 && !musicPlayer.patchesActive())
+  { // the speed shifter is part of the decoder patches, the tag keeps normal speed
+    Serial.println(F("no speed control without decoder patches"));
+  }
+  else if (result == 5)
+  { // if play mode is "audio book" (i.e. 5) the speed can be selected, 0 on the tag is normal speed
+    result = voiceMenu(playInfoList, 4);
+    if (result > 0)
+    {
+      playInfoList[0].speed = result;
+      nfcData->special = result / SPEED_STEP;
+    }
+    else
+    {
+      return returnValue;
+    }
+  }
    
   nfcData->cookie = 42;
 
   writeCard(nfcData);
 
   // read buttons before leaving in order to avoid button event when reentering main loop
-  delay(100);
+  waitFeeding(100);
 
   lButton.read();
   mButton.read();
@@ -1097,27 +1368,17 @@ bool writeCard(nfcTagData *dataOut)
 /*---------------------------------
 track handling routines MOVE to extra file later on
 ---------------------------------*/
-// find line in index file for given path (from NFC tag)
-uint16_t findLine(nfcTagData *tagData)
+// find folder in index file for given path (from NFC tag)
+uint16_t findFolder(nfcTagData *tagData)
 {
-  uint16_t lineNumber = 0;
-  char buffer[37];
-
-  sdin.open("/index.txt"); // open indexfile
-  sdin.seekg(0);           // go to file position 0
-
-  while (true)
-  {
-    if (!sdin.getline(buffer, 37, '\n'))
-      break;
-    ++lineNumber;
-    if (strstr(buffer, tagData->pname))
-    {
-      break;
-    }
-  }
-  sdin.close();
-  return lineNumber;
+  char name[sizeof(tagData->pname) + 1]; // path on the tag is not 0 terminated if it uses all bytes
+
+  memcpy(name, tagData->pname, sizeof(tagData->pname));
+  name[sizeof(tagData->pname)] = '\0';
+  musicPlayer.beginBusAccess();
+  uint16_t folder = libraryIndex.findFolder(name);
+  musicPlayer.endBusAccess();
+  return folder;
 }
 
 // select next track
@@ -1152,51 +1413,31 @@ void selectPrevious(playInfo playInfoList[])
   }
 }
 
-// selectPlayFolder looks-up a lineNumber and trackCount in the indexfile corresponding to a folder number
+// selectPlayFolder looks-up a folder and its trackCount in the indexfile corresponding to a folder number
 void selectPlayFolder(playInfo playInfoList[], uint8_t foldernum)
 {
-
-  //stop playing before trying to access SD-Card, otherwhise SPI bus is too busy
-  if (musicPlayer.playingMusic)
-    musicPlayer.stopPlaying();
+  musicIndexFolder folder;
 
   Serial.println(F("select folder"));
 
-  char *pch;
-  sdin.open("/index.txt");
-  
-  sdin.seekg(0);
-  uint8_t i = 1;
-  uint16_t lineNumber = 0;
-  char buffer[50];
-
-  while (i <= foldernum)
-  {
-    if (!sdin.getline(buffer, 50, '\n'))
-    {
-      break;
-    }
-    pch = strpbrk(buffer, "/"); // locate "/" in order to filter out lines in index file containing the path
-    if (pch != NULL)
-    {
-      i = i + 1;
-    }
-    ++lineNumber;
-  }
-  sdin.close();
+  // folder numbers start at 1, stay on the last folder when browsing beyond it
+  uint16_t id = foldernum - 1;
+  if (id >= libraryIndex.folderCount())
+    id = libraryIndex.folderCount() - 1;
 
-  playInfoList[0].pathLine = lineNumber;
-  pch = strtok(buffer, "\t");
-  pch = strtok(NULL, "\t");
-  playInfoList[0].trackCnt = atoi(pch); //convert trackcount to int
+  playInfoList[0].folder = id;
+  musicPlayer.beginBusAccess(); // the menu prompt keeps playing
+  playInfoList[0].trackCnt = libraryIndex.readFolder(id, &folder) ? folder.trackCnt : 0;
+  musicPlayer.endBusAccess();
   playInfoList[0].currentTrack = 1;
   playInfoList[0].playPos = 0;
+  playInfoList[0].speed = 100;
   return;
 }
 
 void playMenuOption(int option)
 {
-  if (musicPlayer.playingMusic)
+  if (playerStatus().playing())
     musicPlayer.stopPlaying();
   switch (option)
   {
@@ -1223,57 +1464,135 @@ void playMenuOption(int option)
   }
 }
 
-// start playing track
-void startPlaying(playInfo playInfoList[])
+// build the full path of a track of the current folder from the index file
+bool getTrackPath(playInfo playInfoList[], uint8_t track, char *path, musicIndexTrack *record)
 {
-  char fBuffer[13]; //file buffer
-  char buffer[50];  //full path buffer
+  musicPlayer.beginBusAccess(); // music keeps playing during the lookup
+  bool found = libraryIndex.trackPath(playInfoList[0].folder, track, path, record);
+  musicPlayer.endBusAccess();
+  return found;
+}
 
- 
-  //get full path to file
-  //---------------------
-  //1. open index file and go to beginning of file
-  if (musicPlayer.playingMusic)
-    musicPlayer.stopPlaying(); //stop playing first, since SD library is unable to access two files at the time
-  
-  sdin.open("/index.txt");    // open indexfile on SD card
-  sdin.seekg(0);              // rewind filepointer to the start of the file
-  
-  //2. calculate linenumbers to look up for filename
-  uint16_t fLine = playInfoList[0].pathLine - playInfoList[0].trackCnt + playInfoList[0].currentTrack - 1;
+// first frame of a track as stored in the index, the player probes the file if the index doesn't know it
+uint32_t audioStart(musicIndexTrack *record)
+{
+  return (record->flags & MUSICINDEX_TRACK_PROBED) ? record->audioStart : VS1053_AUDIOSTART_PROBE;
+}
+
+// print play time as m:ss
+void printMillis(uint32_t ms)
+{
+  uint32_t s = ms / 1000;
+  Serial.print(s / 60);
+  Serial.print(':');
+  if (s % 60 < 10)
+    Serial.print('0');
+  Serial.print(s % 60);
+}
 
-  //3. retrieve filename  
-  for (uint16_t i = 1; i < fLine; i++) //go to line with filename
+// print reads, average and worst read time and throughput of a read path
+void printReadStats(const __FlashStringHelper *path, VS1053_ReadStats *stats)
+{
+  Serial.print(path);
+  Serial.print(F(" reads: "));
+  Serial.print(stats->reads);
+  Serial.print(F(" avg us: "));
+  Serial.print(stats->reads ? stats->micros / stats->reads : 0);
+  Serial.print(F(" max us: "));
+  Serial.print(stats->maxMicros);
+  Serial.print(F(" kB/s: "));
+  Serial.println(stats->micros ? (uint32_t)((uint64_t)stats->bytes * 1000 / stats->micros) : 0);
+}
+
+// print the player's telemetry, feed times as a histogram by duration in us
+void printTelemetry()
+{
+  VS1053_Telemetry t;
+  musicPlayer.telemetry(&t);
+  Serial.print(F("starved: "));
+  Serial.print(t.starved);
+  Serial.print(F(" fed kbps: "));
+  Serial.print(t.fedKbps);
+  Serial.print(F(" bitrate: "));
+  Serial.print(t.bitrate);
+  Serial.print(F(" decode s: "));
+  Serial.println(t.decodeTime);
+  Serial.print(F("speed %: "));
+  Serial.print(t.speed);
+  Serial.print(F(" need kbps: "));
+  Serial.println((uint32_t)t.bitrate * t.speed / 100);
+  Serial.print(F("isr permille: "));
+  Serial.print(t.isrPermille);
+  Serial.print(F(" edges held: "));
+  Serial.print(t.edgesHeld);
+  Serial.print(F(" tick feeds: "));
+  Serial.println(t.tickFeeds);
+  Serial.print(F("decoder recoveries: "));
+  Serial.print(t.recoveries);
+  Serial.print(F(" tracks given up: "));
+  Serial.println(t.stallSkips);
+  Serial.print(F("feed us"));
+  for (uint8_t i = 0; i < VS1053_FEEDBINS; i++)
   {
-    sdin.ignore(50, '\n');
+    if (VS1053_Telemetry::binLimit(i))
+    {
+      Serial.print(F(" <"));
+      Serial.print(VS1053_Telemetry::binLimit(i));
+    }
+    else
+    {
+      Serial.print(F(" >="));
+      Serial.print(VS1053_Telemetry::binLimit(i - 1));
+    }
+    Serial.print(':');
+    Serial.print(t.feedBins[i]);
   }
-  sdin.getline(fBuffer, 13, '\n'); //copy filename to fBuffer
+  Serial.print(F(" max: "));
+  Serial.println(t.feedMaxMicros);
+}
+
+// step through the play speeds on the current track, at each the feeder has to
+// sustain bitrate * speed, underruns show where the SD card or the feeder can't
+void speedSweep()
+{
+  static const uint16_t speeds[] = {100, 125, 150, 175, 200, 250};
+  uint16_t restore = musicPlayer.playSpeed();
+  VS1053_Telemetry t;
 
-  //4. retrieve pathname
-  for (uint16_t i = fLine+1; i < playInfoList[0].pathLine; i++) //go to path line
+  for (uint8_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]) && playerStatus().playing(); i++)
   {
-    sdin.ignore(50, '\n');
+    musicPlayer.setPlaySpeed(speeds[i]);
+    waitFeeding(VS1053_TELEMETRY_INTERVAL); // decoder settles, the bitrate sample follows
+    musicPlayer.telemetry(&t);
+    uint16_t starved = t.starved;
+    uint32_t bytes = t.fedBytes;
+    uint32_t start = millis();
+    waitFeeding(SPEED_SWEEP);
+    uint32_t elapsed = millis() - start;
+    musicPlayer.telemetry(&t);
+
+    Serial.print(F("speed %: "));
+    Serial.print(speeds[i]);
+    Serial.print(F(" need kbps: "));
+    Serial.print((uint32_t)t.bitrate * speeds[i] / 100);
+    Serial.print(F(" fed kbps: "));
+    Serial.print((t.fedBytes - bytes) * 8 / elapsed);
+    Serial.print(F(" underruns: "));
+    Serial.println((uint16_t)(t.starved - starved));
   }
-  sdin.getline(buffer, 50, '\n'); //copy pathname to buffer
-  sdin.close();
-  strtok(buffer, "\t");
-  Serial.println(buffer);
-  strcat(buffer, "/");
-  strcat(buffer, fBuffer); //concatenate the two strings
+  musicPlayer.setPlaySpeed(restore);
+}
 
-  Serial.println();
-  Serial.print(F("current track pos: "));
-  
-  //update tracknum on display
-  //--------------------------
-  Serial.println(playInfoList[0].currentTrack);
-  sprintf(message, "%d", playInfoList[0].currentTrack);
-  if (playInfoList[0].currentTrack < 10)
+// show track number on LED display, font depends on the number of digits
+void showTrackNumber(uint8_t track)
+{
+  sprintf(message, "%d", track);
+  if (track < 10)
   {    
       mx1.setFont(pFontWide);
       printText(0, MAX_DEVICES1 - 1, message);
   }
-  else if (playInfoList[0].currentTrack >= 10 && playInfoList[0].currentTrack < 20)
+  else if (track >= 10 && track < 20)
   {
     mx1.setFont(pFontNormal);
     printText(0, MAX_DEVICES1 - 1, message);
@@ -1283,18 +1602,124 @@ void startPlaying(playInfo playInfoList[])
     mx1.setFont(pFontCondensed);
     printText(0, MAX_DEVICES1 - 1, message);
   }
+}
+
+// start playing track
+void startPlaying(playInfo playInfoList[])
+{
+  char buffer[MUSICINDEX_PATHLEN + MUSICINDEX_SFNLEN];  //full path buffer
+  uint32_t startTime = micros(); // skip latency, button to armed start, the main loop reports first audio
+  uint16_t misses = libraryIndex.cacheMisses;
+
+  //get full path to file, the current track keeps playing meanwhile
+  //---------------------
+  bool found = getTrackPath(playInfoList, playInfoList[0].currentTrack, buffer, &trackInfo);
+
+  // resume logic: don't resume in the last seconds of a track
+  if (found && playInfoList[0].playPos != 0 && trackInfo.duration != 0 &&
+      musicIndexMillis(&trackInfo, playInfoList[0].playPos) + RESUME_MIN_LEFT * 1000UL >= trackInfo.duration)
+  {
+    if (selectNext(playInfoList)) // continue with the following track
+      found = getTrackPath(playInfoList, playInfoList[0].currentTrack, buffer, &trackInfo);
+    else // last track, start it over
+      playInfoList[0].playPos = 0;
+  }
+  queueWait = false; // playback restarts, queue the following track right away
+  if (!found)
+  {
+    printerror(303, 0); // track not in the index, don't play the stale record
+    return;
+  }
+  Serial.println(buffer);
+  Serial.print(F("duration: "));
+  printMillis(trackInfo.duration);
+  Serial.print(F(" bitrate: "));
+  Serial.println(trackInfo.bitrate);
+
+  Serial.println();
+  Serial.print(F("current track pos: "));
+  
+  //update tracknum on display
+  //--------------------------
+  Serial.println(playInfoList[0].currentTrack);
+  showTrackNumber(playInfoList[0].currentTrack);
   
   //start playing selected File
   //----------------------------
 
-  if (playInfoList[0].playPos !=0)
+  // open by directory entry in the folder kept open by the index, the path is the fallback
+  musicPlayer.beginBusAccess();
+  FatFile *dir = libraryIndex.folderDir(playInfoList[0].folder);
+  musicPlayer.endBusAccess();
+  if (playerStatus().playing())
+    musicPlayer.stopPlaying(); // only now, switching tracks is the one reason to stop
+  musicPlayer.setPlaySpeed(playInfoList[0].speed);
+  uint32_t start = playInfoList[0].playPos ? VS1053_AUDIOSTART_PROBE : audioStart(&trackInfo);
+  bool started = dir ? musicPlayer.startPlayingEntry(dir, trackInfo.dirIndex, playInfoList[0].playPos, start)
+                     : musicPlayer.startPlayingFile(buffer, playInfoList[0].playPos, start);
+  if (!started)
+    printerror(201, 0);
+  else
+    audioWait = startTime; // the start is armed, the main loop reports the first audio
+  Serial.print(F("skip us: "));
+  Serial.print(micros() - startTime);
+  Serial.println(libraryIndex.cacheMisses == misses ? F(" (cached)") : F(" (index read)"));
+}
+
+// open the following track while the current one plays, the player switches to it without a gap
+void queueNext(playInfo playInfoList[])
+{
+  char buffer[MUSICINDEX_PATHLEN + MUSICINDEX_SFNLEN];  //full path buffer
+
+  if (musicPlayer.nextQueued() || playInfoList[0].currentTrack >= playInfoList[0].trackCnt)
+    return;
+  if (queueWait && millis() - queueTime < QUEUE_RETRY) // don't rescan the index on every loop after a failure
+    return;
+
+  musicIndexTrack record;
+  bool queued = false;
+  if (getTrackPath(playInfoList, playInfoList[0].currentTrack + 1, buffer, &record))
   {
-    if (!musicPlayer.startPlayingFile(buffer,playInfoList[0].playPos)) // start playing from given position
+    FatFile *dir = libraryIndex.folderDir(playInfoList[0].folder);
+    queued = dir ? musicPlayer.queueNextEntry(dir, record.dirIndex, audioStart(&record))
+                 : musicPlayer.queueNextFile(buffer, audioStart(&record));
+    if (!queued)
       printerror(201, 0);
   }
-  else {
-    if (!musicPlayer.startPlayingFile(buffer)) // start playing from file start
-      printerror(201,0);
+  else
+    printerror(303, 0);
+  queueWait = !queued;
+  queueTime = millis();
+}
+
+// open latency of the last track of every folder, by path and by directory entry
+void benchmarkOpen()
+{
+  char buffer[MUSICINDEX_PATHLEN + MUSICINDEX_SFNLEN];
+  musicIndexFolder folder;
+  musicIndexTrack record;
+
+  Serial.println(F("entries path us entry us"));
+  for (uint16_t f = 0; f < libraryIndex.folderCount(); f++)
+  {
+    if (!libraryIndex.readFolder(f, &folder) || !libraryIndex.trackPath(f, folder.trackCnt, buffer, &record))
+      continue;
+    FatFile *dir = libraryIndex.folderDir(f); // kept open by the player, not part of the open
+    uint32_t t = micros();
+    File byPath = SD.open(buffer);
+    uint32_t pathTime = micros() - t;
+    File byEntry;
+    t = micros();
+    bool ok = dir && byEntry.open(dir, record.dirIndex, O_READ);
+    uint32_t entryTime = micros() - t;
+    Serial.print(folder.entries);
+    Serial.print(' ');
+    Serial.print(byPath ? pathTime : 0);
+    Serial.print(' ');
+    Serial.println(ok ? entryTime : 0);
+    byPath.close();
+    byEntry.close();
+    musicPlayer.feedRing();
   }
 }
 
@@ -1365,74 +1790,40 @@ void printText(uint8_t modStart, uint8_t modEnd, char *pMsg)
 }
 
 /*---------------------------------
-routine to index SD file structure
+routine to switch the SD file structure index
 ---------------------------------*/
-void indexDirectoryToFile(File dir, File *indexFile)
+void installIndex(playInfo playInfoList[])
 {
-  char fname[13];
-  static char dirName[50] = "/";
+  char paths[3][MUSICINDEX_PATHLEN];
+  musicIndexFolder folder;
 
-  // Begin at the start of the directory
-  dir.rewindDirectory();
-  uint8_t trackCnt = 0;
-  while (true)
+  // remember the folders of the recent list, their ids change with the index
+  for (uint8_t i = 0; i < 3; i++)
   {
-    File entry = dir.openNextFile();
-    if (!entry)
-    {
-      // no more files or folder in this directory
-      // print current directory name if there are MP3 tracks in the directory
-      if (trackCnt != 0)
-      {
-        indexFile->write(dirName + 1); // avoid printing / at the "begining"
-        indexFile->write('\t');
-        indexFile->print(trackCnt);
-        indexFile->write('\r');
-        indexFile->write('\n');
-        trackCnt = 0;
-      }
-      // roll back directory name
-      char *pIndex;
-      pIndex = strrchr(dirName, '/'); // search last occurence of '/'
-      if (pIndex == NULL)
-      {
-        break; // no more '/' in the dirName
-      }
-      uint8_t index = pIndex - dirName; // calculate index position from pointer addresses
-      if (index == 0)
-      {
-        break; // don't roll back any further, reached root
-      }
-      dirName[index] = '\0'; // null terminate at position of '/'
-      break;
-    }
-    // there is an entry
-    entry.getSFN(fname);
-    // recurse for directories, otherwise print the file
-    if (entry.isDirectory())
-    {
-      //entry is a directory
-      //update dirName and reset trackCnt
-      strcat(dirName, "/");
-      strcat(dirName, fname);
-      trackCnt = 0;
-      indexDirectoryToFile(entry, indexFile);
-    }
+    if (playInfoList[i].folder != MUSICINDEX_NONE && libraryIndex.readFolder(playInfoList[i].folder, &folder))
+      strcpy(paths[i], folder.path);
     else
-    {
-      char *pch;
-      pch = strstr(fname, ".MP3");
-      if (pch == NULL)
-        pch = strstr(fname, ".mp3");
-      if (pch)
-      {
-        indexFile->write(fname);
-        indexFile->write('\r');
-        indexFile->write('\n');
-        trackCnt += 1;
-      }
-    }
-    entry.close();
+      playInfoList[i].folder = MUSICINDEX_NONE;
+  }
+
+  Serial.print(F("index "));
+  Serial.print(indexer.folderCount());
+  Serial.print(F(" folders "));
+  Serial.print(indexer.trackCount());
+  Serial.print(F(" tracks "));
+  Serial.print(indexer.changedFolders());
+  Serial.print(F(" changed"));
+  if (!indexer.install())
+  {
+    Serial.println(F(", kept"));
+    return;
+  }
+  Serial.println(F(", installed"));
+
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    if (playInfoList[i].folder != MUSICINDEX_NONE)
+      playInfoList[i].folder = libraryIndex.findPath(paths[i], playInfoList[i].folder);
   }
 }
 
@@ -1517,14 +1908,17 @@ void printPlayInfoList(playInfo playInfoList[])
     Serial.print(F("\t mode:"));
     Serial.print(playInfoList[i].mode);
 
-    Serial.print(F("\t line:"));
-    Serial.print(playInfoList[i].pathLine);
+    Serial.print(F("\t folder:"));
+    Serial.print(playInfoList[i].folder);
 
     Serial.print(F("\t track:"));
     Serial.print(playInfoList[i].currentTrack);
     
     Serial.print(F("\t file pos:"));
-    Serial.println(playInfoList[i].playPos);
+    Serial.print(playInfoList[i].playPos);
+
+    Serial.print(F("\t speed:"));
+    Serial.println(playInfoList[i].speed);
   }
   Serial.println();
 }
@@ -1570,6 +1964,11 @@ void printerror(int errorcode, int source)
     Serial.println(F("start playing"));
     break;
   }
+  case 202:
+  {
+    Serial.println(F("loading decoder patches"));
+    break;
+  }
   // error codes for SD card 300 - 399
   case 301:
   {
@@ -1581,6 +1980,11 @@ void printerror(int errorcode, int source)
     Serial.println(F("opening file"));
     break;
   }
+  case 303:
+  {
+    Serial.println(F("reading index"));
+    break;
+  }
   // default error
   default:
   {
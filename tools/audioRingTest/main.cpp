@@ -0,0 +1,205 @@
+/***************************************************
+audioRingTest
+
+Drives AudioRing the way the player does: the main
+loop reads sectors, often short ones and sometimes
+several in one piece, the DREQ interrupt takes a
+random number of chunks at random points and a seek
+lets it discard the read ahead data.
+
+  audioRingTest [SEED]
+
+The producer writes a position dependent byte stream.
+The consumer checks every byte against that stream,
+fill() and bytes() against the bytes in flight, and
+at the end that nothing was lost or repeated across
+wrap-around and discard().
+
+****************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AdaMisch_AudioRing.h>
+
+#define STEPS 200000 // producer/consumer turns per run
+
+static uint32_t seed = 1;
+static uint32_t rnd = 1; // xorshift, runs are reproducible per seed
+
+static uint32_t random32()
+{
+  rnd ^= rnd << 13;
+  rnd ^= rnd >> 17;
+  rnd ^= rnd << 5;
+  return rnd;
+}
+
+// byte at a stream position, neighbouring chunks and sectors differ
+static uint8_t streamByte(uint32_t pos)
+{
+  return (uint8_t)(pos ^ (pos >> 8) * 7 ^ (pos >> 16) * 13);
+}
+
+struct counters
+{
+  uint32_t produced;  // stream bytes committed by the producer
+  uint32_t consumed;  // stream position of the next byte the consumer expects
+  uint32_t fed;       // bytes the consumer got
+  uint32_t discarded; // bytes dropped by discard()
+  uint32_t chunks;    // chunks committed, including empty ones
+  uint32_t popped;    // chunks the consumer released one by one
+  uint32_t shortReads;
+  uint32_t multiReads;
+  uint32_t emptyChunks;
+  uint32_t discards;
+};
+
+static bool failed = false;
+
+static void fail(const char *what, const counters &c)
+{
+  if (!failed)
+    fprintf(stderr, "FAIL sectors %d seed %u: %s (produced %u consumed %u)\n",
+            AUDIORING_SECTORS, seed, what, c.produced, c.consumed);
+  failed = true;
+}
+
+// main loop: as many sectors as fit without wrapping, each may be short,
+// published one by one like readRaw() does after a multi block read
+static void produce(AudioRing *ring, counters *c)
+{
+  uint8_t n = ring->sectorsFreeLinear();
+  if (!n)
+  {
+    if (ring->sectorFree())
+      fail("sectorFree() without a linear sector", *c);
+    return;
+  }
+  n = 1 + random32() % n;
+  if (n > 1)
+    c->multiReads++;
+  uint8_t *buf = ring->sectorBuffer();
+  uint16_t len[256 / AUDIORING_SECTORCHUNKS];
+  uint32_t pos = c->produced;
+  for (uint8_t s = 0; s < n; s++)
+  {
+    len[s] = AUDIORING_SECTORLEN;
+    if (random32() % 4 == 0) // end of file, or the realigning first sector after a seek
+    {
+      len[s] = 1 + random32() % (AUDIORING_SECTORLEN - 1);
+      c->shortReads++;
+    }
+    uint8_t *p = buf + s * AUDIORING_SECTORLEN;
+    for (uint16_t i = 0; i < len[s]; i++)
+      p[i] = streamByte(pos++);
+    memset(p + len[s], 0xA5, AUDIORING_SECTORLEN - len[s]); // must never reach the decoder
+  }
+  for (uint8_t s = 0; s < n; s++)
+  {
+    if (ring->sectorBuffer() != buf + s * AUDIORING_SECTORLEN)
+      fail("sectors of one read are not contiguous", *c);
+    ring->commitSector(len[s]);
+    c->produced += len[s];
+    c->chunks += AUDIORING_SECTORCHUNKS;
+  }
+}
+
+// DREQ interrupt: a few chunks, as many as the decoder takes right now
+static void consume(AudioRing *ring, counters *c)
+{
+  uint8_t want = random32() % (AUDIORING_SECTORCHUNKS + 2);
+  while (want-- && !ring->empty())
+  {
+    uint8_t len = ring->chunkLen();
+    if (len > AUDIORING_CHUNKLEN)
+      fail("chunk longer than AUDIORING_CHUNKLEN", *c);
+    if (!len)
+      c->emptyChunks++;
+    const uint8_t *p = ring->chunk();
+    for (uint8_t i = 0; i < len; i++)
+    {
+      if (p[i] != streamByte(c->consumed))
+      {
+        fail("wrong byte", *c);
+        return;
+      }
+      c->consumed++;
+    }
+    c->fed += len;
+    c->popped++;
+    ring->pop();
+  }
+}
+
+// bytes and chunks in flight must match what the consumer has not seen yet
+static void checkFill(const AudioRing &ring, const counters &c)
+{
+  if (ring.bytes() != c.produced - c.consumed)
+    fail("bytes() differs from the bytes in flight", c);
+  if (ring.fill() > AUDIORING_CHUNKS || ring.empty() != (ring.fill() == 0))
+    fail("fill() out of range", c);
+}
+
+static int run()
+{
+  static AudioRing ring;
+  counters c;
+  memset(&c, 0, sizeof(c));
+  rnd = seed;
+  ring.reset();
+
+  for (uint32_t step = 0; step < STEPS && !failed; step++)
+  {
+    switch (random32() % 8)
+    {
+    case 0:
+    case 1:
+    case 2:
+      produce(&ring, &c);
+      break;
+    case 7:
+      if (random32() % 64 == 0) // seek: the interrupt drops the read ahead data
+      {
+        c.discarded += c.produced - c.consumed;
+        c.consumed = c.produced;
+        c.popped += ring.fill();
+        ring.discard();
+        c.discards++;
+        break;
+      }
+      // fall through
+    default:
+      consume(&ring, &c);
+    }
+    checkFill(ring, c);
+  }
+  while (!ring.empty() && !failed) // end of track, the decoder takes the rest
+    consume(&ring, &c);
+
+  if (!failed && c.fed + c.discarded != c.produced)
+    fail("bytes lost or repeated", c);
+  if (!failed && c.popped != c.chunks)
+    fail("chunks lost or repeated", c);
+  if (!failed && (!c.shortReads || !c.discards || !c.emptyChunks ||
+                  (AUDIORING_SECTORS > 1 && !c.multiReads) || c.chunks < 2 * 256))
+    fail("run did not cover short reads, discards, multi sector reads and wrap-around", c);
+  if (failed)
+    return 1;
+  printf("sectors %d seed %u: ok, %u bytes fed, %u discarded, %u chunks, "
+         "%u short reads, %u multi sector reads, %u discards\n",
+         AUDIORING_SECTORS, seed, c.fed, c.discarded, c.chunks,
+         c.shortReads, c.multiReads, c.discards);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc > 2 || (argc == 2 && !(seed = strtoul(argv[1], NULL, 0))))
+  {
+    fprintf(stderr, "usage: audioRingTest [SEED], SEED not 0\n");
+    return 2;
+  }
+  return run();
+}
@@ -0,0 +1,247 @@
+/***************************************************
+dirTree
+
+A local folder shown as the player will see it on
+the card, see dirTree.h.
+
+****************************************************/
+
+#include "dirTree.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+// characters a short name may hold besides A-Z and 0-9
+static bool sfnChar(char c)
+{
+  return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (c && strchr("$%'-_@~`!(){}^#&", c));
+}
+
+// UTF-16 units of a UTF-8 name, 13 go into one long name entry
+static size_t utf16Len(const std::string &name)
+{
+  size_t n = 0;
+  for (unsigned char c : name)
+  {
+    if ((c & 0xC0) != 0x80)
+      n += (c >= 0xF0) ? 2 : 1;
+  }
+  return n;
+}
+
+// base or extension as a short name part, false if it needs a long name
+static bool sfnPart(const std::string &s, size_t max, std::string &out, bool *lower)
+{
+  bool upper = false;
+  *lower = false;
+  out.clear();
+  for (char c : s)
+  {
+    if (c >= 'a' && c <= 'z')
+    {
+      *lower = true;
+      c -= 'a' - 'A';
+    }
+    else if (c >= 'A' && c <= 'Z')
+    {
+      upper = true;
+    }
+    if (!sfnChar(c))
+      return false;
+    out += c;
+  }
+  return out.size() <= max && !(upper && *lower); // one case only, the NT flags keep it
+}
+
+// basis of a generated short name: upper case, invalid characters replaced, spaces and dots dropped
+static std::string sfnBasis(const std::string &s, bool *lossy)
+{
+  std::string out;
+  for (char c : s)
+  {
+    if (c == ' ' || c == '.')
+    {
+      *lossy = true;
+      continue;
+    }
+    if (c >= 'a' && c <= 'z')
+      c -= 'a' - 'A';
+    if (!sfnChar(c))
+    {
+      *lossy = true;
+      if ((c & 0xC0) == 0x80)
+        continue; // one '_' per UTF-8 character
+      c = '_';
+    }
+    out += c;
+  }
+  return out;
+}
+
+// 11 byte name and NT case flags like a FAT driver creates them, long name entries needed
+static uint8_t shortName(const std::string &name, const std::vector<std::string> &taken,
+                         uint8_t *raw, uint8_t *flags)
+{
+  size_t dot = name.rfind('.');
+  if (dot == 0 || dot == std::string::npos)
+    dot = name.size();
+  std::string base = name.substr(0, dot);
+  std::string ext = (dot < name.size()) ? name.substr(dot + 1) : "";
+  std::string b, e;
+  bool lowerBase, lowerExt;
+  bool fits = sfnPart(base, 8, b, &lowerBase) && sfnPart(ext, 3, e, &lowerExt) && !b.empty() &&
+              std::find(taken.begin(), taken.end(), b + (e.empty() ? "" : "." + e)) == taken.end();
+  uint8_t lfn = 0;
+
+  if (fits)
+  {
+    *flags = (lowerBase ? 0x08 : 0) | (lowerExt ? 0x10 : 0);
+  }
+  else
+  {
+    size_t start = std::min(name.find_first_not_of('.'), dot); // leading dots are dropped
+    bool lossy = start > 0;
+    b = sfnBasis(name.substr(start, dot - start), &lossy);
+    e = sfnBasis(ext, &lossy);
+    if (b.size() > 8 || e.size() > 3 || b.empty())
+      lossy = true;
+    e.resize(std::min<size_t>(e.size(), 3));
+    if (b.empty())
+      b = "_";
+    *flags = 0;
+    lfn = (utf16Len(name) + 12) / 13;
+
+    // numeric tail on loss or collision, ~1 first
+    std::string full = b.substr(0, 8) + (e.empty() ? "" : "." + e);
+    if (lossy || std::find(taken.begin(), taken.end(), full) != taken.end())
+    {
+      for (uint32_t n = 1;; n++)
+      {
+        std::string tail = "~" + std::to_string(n);
+        std::string candidate = b.substr(0, 8 - tail.size()) + tail;
+        if (std::find(taken.begin(), taken.end(), candidate + (e.empty() ? "" : "." + e)) == taken.end())
+        {
+          b = candidate;
+          break;
+        }
+      }
+    }
+  }
+  memset(raw, ' ', 11);
+  memcpy(raw, b.data(), b.size());
+  memcpy(raw + 8, e.data(), e.size());
+  return lfn;
+}
+
+bool dirTree::open(const char *path)
+{
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+    return false;
+  _paths.assign(1, path);
+  _ids.clear();
+  return true;
+}
+
+uint32_t dirTree::id(const std::string &path)
+{
+  auto it = _ids.find(path);
+  if (it != _ids.end())
+    return it->second;
+  _paths.push_back(path);
+  return _ids[path] = _paths.size() - 1;
+}
+
+bool dirTree::listDir(uint32_t id, std::vector<fatVolume::entry> &entries)
+{
+  entries.clear();
+  if (id >= _paths.size())
+    return false;
+  DIR *dir = opendir(_paths[id].c_str());
+  if (!dir)
+    return false;
+  std::vector<std::string> names;
+  while (struct dirent *d = readdir(dir))
+  {
+    if (strcmp(d->d_name, ".") && strcmp(d->d_name, ".."))
+      names.push_back(d->d_name);
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+
+  std::vector<std::string> taken;
+  uint32_t slot = id ? 2 : 0; // subfolders start with the . and .. entries
+  for (const std::string &name : names)
+  {
+    std::string path = _paths[id] + "/" + name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !(S_ISDIR(st.st_mode) || S_ISREG(st.st_mode)) ||
+        st.st_size > 0xFFFFFFFFLL)
+    {
+      continue; // nothing that ends up on the card
+    }
+
+    fatVolume::entry e;
+    memset(e.raw, 0, sizeof(e.raw));
+    uint8_t lfn = shortName(name, taken, e.raw, &e.raw[12]);
+    e.isDir = S_ISDIR(st.st_mode);
+    e.size = e.isDir ? 0 : st.st_size;
+    e.raw[11] = e.isDir ? 0x10 : 0x20;
+    struct tm t;
+    localtime_r(&st.st_mtime, &t);
+    if (t.tm_year < 80) // FAT dates start 1980
+    {
+      memset(&t, 0, sizeof(t));
+      t.tm_year = 80;
+      t.tm_mday = 1;
+    }
+    put16(e.raw + 22, (t.tm_hour << 11) | (t.tm_min << 5) | (t.tm_sec / 2));
+    put16(e.raw + 24, ((t.tm_year - 80) << 9) | ((t.tm_mon + 1) << 5) | t.tm_mday);
+    put32(e.raw + 28, e.size);
+    slot += lfn;
+    e.index = slot++;
+
+    fatVolume::formatSFN(e.raw, e.sfn);
+    std::string upper(e.sfn);
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    taken.push_back(upper);
+    if (lfn)
+      e.longName = name;
+    e.cluster = this->id(path);
+    entries.push_back(e);
+  }
+  return true;
+}
+
+dirTree::file dirTree::openFile(const fatVolume::entry &e)
+{
+  file f;
+  f.fd = (e.cluster < _paths.size()) ? ::open(_paths[e.cluster].c_str(), O_RDONLY) : -1;
+  f.size = e.size;
+  return f;
+}
+
+void dirTree::closeFile(file *f)
+{
+  if (f->fd >= 0)
+    close(f->fd);
+  f->fd = -1;
+}
+
+int dirTree::read(file *f, uint32_t pos, uint8_t *buf, uint16_t len)
+{
+  if (f->fd < 0 || pos >= f->size)
+    return 0;
+  if (len > f->size - pos)
+    len = f->size - pos;
+  ssize_t n = pread(f->fd, buf, len, pos);
+  return n < 0 ? 0 : n;
+}
@@ -0,0 +1,50 @@
+/***************************************************
+dirTree
+
+A local folder shown the way the player will see it
+once it is copied to an empty card: the entries of a
+folder in byte order of their names (the order rsync
+writes them), 8.3 names and entry indexes as a FAT
+driver creates them and the write time of the file.
+
+Folders and files are identified by the number in
+entry::cluster, 0 is the top folder.
+
+****************************************************/
+
+#ifndef DIRTREE_H
+#define DIRTREE_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "fatVolume.h"
+
+class dirTree
+{
+public:
+  struct file
+  {
+    int fd;
+    uint32_t size;
+  };
+
+  bool open(const char *path);  // false if path is no folder
+
+  // entries SdFat's openNext() would return, with entry indexes as on the card
+  bool listDir(uint32_t id, std::vector<fatVolume::entry> &entries);
+
+  file openFile(const fatVolume::entry &e);
+  void closeFile(file *f);
+  // reads len bytes at pos, returns the bytes read, 0 behind the end
+  int read(file *f, uint32_t pos, uint8_t *buf, uint16_t len);
+
+private:
+  uint32_t id(const std::string &path);
+
+  std::vector<std::string> _paths;         // host path of every id handed out
+  std::map<std::string, uint32_t> _ids;    // and back
+};
+
+#endif // DIRTREE_H
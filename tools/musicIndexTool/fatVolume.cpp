@@ -0,0 +1,268 @@
+/***************************************************
+fatVolume
+
+Read-only FAT16/FAT32 access for the host tools.
+
+****************************************************/
+
+#include "fatVolume.h"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+static uint16_t le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t le32(const uint8_t *p) { return le16(p) | ((uint32_t)le16(p + 2) << 16); }
+
+fatVolume::~fatVolume()
+{
+  if (_fd >= 0)
+    close(_fd);
+}
+
+bool fatVolume::readBytes(uint64_t pos, void *buf, size_t len)
+{
+  return pread(_fd, buf, len, pos) == (ssize_t)len;
+}
+
+bool fatVolume::open(const char *path)
+{
+  uint8_t mbr[512];
+
+  _fd = ::open(path, O_RDONLY);
+  if (_fd < 0 || !readBytes(0, mbr, sizeof(mbr)))
+    return false;
+  // like SdFat::begin(): partition 1 first, then a volume without partition table
+  if (mbr[510] == 0x55 && mbr[511] == 0xAA && (mbr[0x1BE] & 0x7F) == 0 &&
+      mount(le32(mbr + 0x1BE + 8)))
+  {
+    return true;
+  }
+  return mount(0);
+}
+
+bool fatVolume::mount(uint32_t lba)
+{
+  uint8_t bpb[512];
+  uint64_t start = (uint64_t)lba * 512;
+
+  if (!readBytes(start, bpb, sizeof(bpb)))
+    return false;
+  uint16_t bytesPerSector = le16(bpb + 11);
+  uint8_t sectorsPerCluster = bpb[13];
+  uint16_t reserved = le16(bpb + 14);
+  uint8_t fatCount = bpb[16];
+  uint16_t rootEntries = le16(bpb + 17);
+  uint32_t sectors = le16(bpb + 19) ? le16(bpb + 19) : le32(bpb + 32);
+  uint32_t fatSectors = le16(bpb + 22) ? le16(bpb + 22) : le32(bpb + 36);
+
+  // SdFat only supports 512 byte sectors
+  if (bytesPerSector != 512 || sectorsPerCluster == 0 || fatCount == 0 || fatSectors == 0 ||
+      (sectorsPerCluster & (sectorsPerCluster - 1)))
+  {
+    return false;
+  }
+  uint32_t rootSectors = (rootEntries * 32 + 511) / 512;
+  uint32_t dataSector = reserved + fatCount * fatSectors + rootSectors;
+  if (sectors <= dataSector)
+    return false;
+  uint32_t clusters = (sectors - dataSector) / sectorsPerCluster;
+
+  _clusterBytes = sectorsPerCluster * 512;
+  _rootStart = start + (uint64_t)(reserved + fatCount * fatSectors) * 512;
+  _rootEntries = rootEntries;
+  _dataStart = start + (uint64_t)dataSector * 512;
+  if (clusters < 4085)
+    return false; // FAT12
+  _fatType = (clusters < 65525) ? 16 : 32;
+  _rootCluster = (_fatType == 32) ? le32(bpb + 44) : 0;
+
+  // the whole first FAT, 4 bytes per cluster at most
+  uint32_t entries = clusters + 2;
+  std::vector<uint8_t> fat((size_t)entries * (_fatType / 8));
+  if (!readBytes(start + (uint64_t)reserved * 512, fat.data(), fat.size()))
+    return false;
+  _fat.resize(entries);
+  for (uint32_t i = 0; i < entries; i++)
+    _fat[i] = (_fatType == 16) ? le16(&fat[i * 2]) : le32(&fat[i * 4]) & 0x0FFFFFFF;
+  return true;
+}
+
+// next cluster of a chain, 0 at the end
+uint32_t fatVolume::next(uint32_t cluster)
+{
+  if (cluster < 2 || cluster >= _fat.size())
+    return 0;
+  uint32_t n = _fat[cluster];
+  uint32_t eoc = (_fatType == 16) ? 0xFFF8 : 0x0FFFFFF8;
+  return (n < 2 || n >= eoc || n >= _fat.size()) ? 0 : n;
+}
+
+// file or subdirectory entry as FatFile::openNext() accepts it
+static bool isFileOrSubdir(const uint8_t *d)
+{
+  return d[0] != 0xE5 && d[0] != '.' && (d[11] & 0x08) == 0; // not deleted, no dot entry, no LFN or label
+}
+
+static uint8_t lfnChecksum(const uint8_t *name)
+{
+  uint8_t sum = 0;
+  for (uint8_t i = 0; i < 11; i++)
+    sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+  return sum;
+}
+
+// the name FatFile::getSFN() returns: base, '.', extension, lower case per the NT flags
+void fatVolume::formatSFN(const uint8_t *d, char *sfn)
+{
+  uint8_t j = 0;
+  for (uint8_t i = 0; i < 11; i++)
+  {
+    if (d[i] == ' ')
+      continue;
+    if (i == 8)
+      sfn[j++] = '.';
+    char c = d[i];
+    uint8_t lower = (i < 8) ? 0x08 : 0x10;
+    if ((d[12] & lower) && c >= 'A' && c <= 'Z')
+      c += 'a' - 'A';
+    sfn[j++] = c;
+  }
+  sfn[j] = '\0';
+}
+
+// UCS-2 to UTF-8
+static void appendUtf8(std::string &s, uint16_t c)
+{
+  if (c < 0x80)
+  {
+    s += (char)c;
+  }
+  else if (c < 0x800)
+  {
+    s += (char)(0xC0 | (c >> 6));
+    s += (char)(0x80 | (c & 0x3F));
+  }
+  else
+  {
+    s += (char)(0xE0 | (c >> 12));
+    s += (char)(0x80 | ((c >> 6) & 0x3F));
+    s += (char)(0x80 | (c & 0x3F));
+  }
+}
+
+bool fatVolume::listDir(uint32_t cluster, std::vector<entry> &entries)
+{
+  std::vector<uint8_t> data;
+
+  entries.clear();
+  if (cluster == 0 && _fatType == 16)
+  {
+    data.resize(_rootEntries * 32);
+    if (!readBytes(_rootStart, data.data(), data.size()))
+      return false;
+  }
+  else
+  {
+    if (cluster == 0)
+      cluster = _rootCluster;
+    for (uint32_t n = 0; cluster; cluster = next(cluster))
+    {
+      if (++n > _fat.size())
+        return false; // loop in the chain
+      size_t at = data.size();
+      data.resize(at + _clusterBytes);
+      if (!readBytes(clusterPos(cluster), &data[at], _clusterBytes))
+        return false;
+    }
+  }
+
+  uint16_t lfn[260];
+  uint8_t lfnOrd = 0, lfnSum = 0;
+  for (size_t pos = 0; pos + 32 <= data.size(); pos += 32)
+  {
+    const uint8_t *d = &data[pos];
+    if (d[0] == 0x00)
+      break; // free, end of the directory
+    if (d[0] != 0xE5 && d[11] == 0x0F)
+    {
+      // long name part, stored last part first
+      uint8_t ord = d[0] & 0x1F;
+      if ((d[0] & 0x40) || ord == 0 || ord > 20)
+      {
+        lfnOrd = ord;
+        memset(lfn, 0, sizeof(lfn));
+      }
+      lfnSum = d[13];
+      static const uint8_t charPos[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+      if (ord >= 1 && ord <= 20)
+      {
+        for (uint8_t i = 0; i < 13; i++)
+          lfn[(ord - 1) * 13 + i] = le16(d + charPos[i]);
+      }
+      continue;
+    }
+    if (!isFileOrSubdir(d))
+    {
+      lfnOrd = 0;
+      continue;
+    }
+
+    entry e;
+    memcpy(e.raw, d, 32);
+    e.index = pos / 32;
+    formatSFN(d, e.sfn);
+    e.isDir = (d[11] & 0x10) != 0;
+    e.cluster = ((uint32_t)le16(d + 20) << 16) | le16(d + 26);
+    if (_fatType == 16)
+      e.cluster &= 0xFFFF;
+    e.size = le32(d + 28);
+    if (lfnOrd && lfnSum == lfnChecksum(d))
+    {
+      for (uint16_t i = 0; i < lfnOrd * 13 && lfn[i] && lfn[i] != 0xFFFF; i++)
+        appendUtf8(e.longName, lfn[i]);
+    }
+    lfnOrd = 0;
+    entries.push_back(e);
+  }
+  return true;
+}
+
+fatVolume::file fatVolume::openFile(const entry &e)
+{
+  file f;
+  f.vol = this;
+  f.size = e.size;
+  if (e.cluster >= 2)
+    f.chain.push_back(e.cluster);
+  return f;
+}
+
+int fatVolume::read(file *f, uint32_t pos, uint8_t *buf, uint16_t len)
+{
+  // like File::seek() and read(): seeking behind the end fails, reads stop at the end
+  if (pos >= f->size)
+    return 0;
+  if (len > f->size - pos)
+    len = f->size - pos;
+
+  uint16_t done = 0;
+  while (done < len)
+  {
+    uint32_t n = (pos + done) / _clusterBytes;
+    while (f->chain.size() <= n)
+    {
+      uint32_t c = f->chain.empty() ? 0 : next(f->chain.back());
+      if (c == 0)
+        return done;
+      f->chain.push_back(c);
+    }
+    uint32_t offset = (pos + done) % _clusterBytes;
+    uint32_t part = _clusterBytes - offset;
+    if (part > (uint32_t)(len - done))
+      part = len - done;
+    if (!readBytes(clusterPos(f->chain[n]) + offset, buf + done, part))
+      return done;
+    done += part;
+  }
+  return done;
+}
@@ -0,0 +1,70 @@
+/***************************************************
+fatVolume
+
+Read-only FAT16/FAT32 access to an SD card image or
+block device, showing directories the way SdFat does:
+entries in on-disk order, 8.3 names as getSFN()
+returns them and the entry index of dirIndex().
+
+****************************************************/
+
+#ifndef FATVOLUME_H
+#define FATVOLUME_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class fatVolume
+{
+public:
+  struct entry
+  {
+    uint8_t     raw[32];   // directory entry as stored
+    uint16_t    index;     // entry index within the directory
+    char        sfn[13];   // 8.3 name
+    std::string longName;  // long file name, empty if none
+    bool        isDir;
+    uint32_t    cluster;   // first cluster
+    uint32_t    size;      // file size
+  };
+
+  struct file // cluster chain of a file, extended on demand
+  {
+    fatVolume *vol;
+    uint32_t size;
+    std::vector<uint32_t> chain;
+  };
+
+  ~fatVolume();
+  bool open(const char *path);  // whole card with partition table or a single volume
+  uint32_t rootCluster() { return _rootCluster; }
+
+  // entries SdFat's openNext() returns, cluster 0 is the FAT16 root directory
+  bool listDir(uint32_t cluster, std::vector<entry> &entries);
+
+  uint32_t next(uint32_t cluster); // following cluster of a chain, 0 at the end
+  uint32_t clusterBytes() { return _clusterBytes; }
+
+  file openFile(const entry &e);
+  // the name FatFile::getSFN() returns for a raw directory entry
+  static void formatSFN(const uint8_t *d, char *sfn);
+  // reads len bytes at pos, returns the bytes read, 0 behind the end
+  int read(file *f, uint32_t pos, uint8_t *buf, uint16_t len);
+
+private:
+  bool mount(uint32_t lba);
+  bool readBytes(uint64_t pos, void *buf, size_t len);
+  uint64_t clusterPos(uint32_t cluster) { return _dataStart + (uint64_t)(cluster - 2) * _clusterBytes; }
+
+  int _fd = -1;
+  uint8_t _fatType = 0;
+  uint32_t _clusterBytes = 0;
+  uint64_t _dataStart = 0;      // byte offset of cluster 2
+  uint64_t _rootStart = 0;      // byte offset of the FAT16 root directory
+  uint32_t _rootEntries = 0;    // FAT16 root directory size
+  uint32_t _rootCluster = 0;    // FAT32 root directory, 0 for FAT16
+  std::vector<uint32_t> _fat;
+};
+
+#endif // FATVOLUME_H
@@ -0,0 +1,321 @@
+/***************************************************
+musicIndexTool
+
+Builds /index.bin for the player on the PC. Reads the
+FAT volume of the SD card (card reader block device or
+image file) and walks it exactly like musicIndexer does,
+so copying the result to the card root gives the same
+index the player would build itself on a full rescan.
+
+  musicIndexTool [-n] [-o index.bin] /dev/sdX
+  musicIndexTool [-n] [-o index.bin] folder/
+
+A local folder is indexed as it will look once copied
+to an empty card in name order, e.g. with rsync -rt.
+Other copies may come out with other 8.3 names or
+entry order, the player then rescans those folders.
+
+-n sorts the tracks of each folder in natural order of
+their long names instead of directory order. Folders
+keep their stamps, so the player keeps that order until
+the folder changes.
+
+****************************************************/
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <mp3Frame.h>
+#include <musicIndexFormat.h>
+#include "dirTree.h"
+#include "fatVolume.h"
+
+static fatVolume volume;
+static dirTree tree;
+static bool fromTree = false; // source is a local folder
+static std::vector<musicIndexTrack> tracks;
+static std::vector<musicIndexFolder> folders;
+static bool naturalSort = false;
+
+// mp3Reader on a fatVolume::file
+static int readFile(void *file, uint32_t pos, uint8_t *buf, uint16_t len)
+{
+  fatVolume::file *f = (fatVolume::file *)file;
+  return f->vol->read(f, pos, buf, len);
+}
+
+// mp3Reader on a dirTree::file
+static int readTreeFile(void *file, uint32_t pos, uint8_t *buf, uint16_t len)
+{
+  return tree.read((dirTree::file *)file, pos, buf, len);
+}
+
+static bool listDir(uint32_t cluster, std::vector<fatVolume::entry> &entries)
+{
+  return fromTree ? tree.listDir(cluster, entries) : volume.listDir(cluster, entries);
+}
+
+// same record as musicIndexWriter::addTrack(File *)
+static musicIndexTrack probeTrack(const fatVolume::entry &e)
+{
+  musicIndexTrack record;
+  mp3SeekInfo info;
+  uint8_t id3[10];
+  fatVolume::file f;
+  dirTree::file t = {-1, 0};
+  if (fromTree)
+    t = tree.openFile(e);
+  else
+    f = volume.openFile(e);
+  mp3Reader read = fromTree ? readTreeFile : readFile;
+  void *file = fromTree ? (void *)&t : (void *)&f;
+
+  memset(&record, 0, sizeof(record));
+  strcpy(record.sfn, e.sfn);
+  record.dirIndex = e.index;
+  record.size = e.size;
+  record.flags = MUSICINDEX_TRACK_PROBED;
+  if (mp3ReadSeekInfo(read, file, 0, record.size, &info))
+  {
+    record.audioStart = info.audioStart;
+    record.bitrate = info.bitrate;
+    record.sampleRate = info.sampleRate;
+    record.duration = info.duration;
+  }
+  else if (read(file, 0, id3, sizeof(id3)) == sizeof(id3))
+  {
+    record.audioStart = mp3ID3Size(id3);
+  }
+  tree.closeFile(&t);
+  return record;
+}
+
+// "Track 2" before "Track 10", case insensitive
+static bool naturalLess(const std::string &a, const std::string &b)
+{
+  size_t i = 0, j = 0;
+  while (i < a.size() && j < b.size())
+  {
+    if (isdigit((unsigned char)a[i]) && isdigit((unsigned char)b[j]))
+    {
+      size_t si = i, sj = j;
+      while (si < a.size() && a[si] == '0')
+        si++;
+      while (sj < b.size() && b[sj] == '0')
+        sj++;
+      size_t ei = si, ej = sj;
+      while (ei < a.size() && isdigit((unsigned char)a[ei]))
+        ei++;
+      while (ej < b.size() && isdigit((unsigned char)b[ej]))
+        ej++;
+      if (ei - si != ej - sj)
+        return ei - si < ej - sj;
+      int c = a.compare(si, ei - si, b, sj, ej - sj);
+      if (c)
+        return c < 0;
+      i = ei;
+      j = ej;
+      continue;
+    }
+    int ca = tolower((unsigned char)a[i]), cb = tolower((unsigned char)b[j]);
+    if (ca != cb)
+      return ca < cb;
+    i++;
+    j++;
+  }
+  return a.size() - i < b.size() - j;
+}
+
+static const std::string &sortName(const fatVolume::entry &e)
+{
+  static std::string sfn;
+  if (!e.longName.empty())
+    return e.longName;
+  sfn = e.sfn;
+  return sfn;
+}
+
+// the walk of musicIndexer: tracks of a folder, its record, then its subfolders
+static bool indexFolder(uint32_t cluster, const std::string &path, uint8_t depth)
+{
+  std::vector<fatVolume::entry> entries;
+  if (!listDir(cluster, entries))
+  {
+    fprintf(stderr, "can't read folder %s\n", path.empty() ? "/" : path.c_str());
+    return false;
+  }
+
+  musicIndexFolder record;
+  memset(&record, 0, sizeof(record));
+  record.stamp = MUSICINDEX_HASHBASIS;
+  for (const fatVolume::entry &e : entries)
+  {
+    record.entries++;
+    record.stamp = musicIndexStamp(record.stamp, e.raw);
+  }
+
+  std::vector<const fatVolume::entry *> files;
+  for (const fatVolume::entry &e : entries)
+  {
+    if (!e.isDir && musicIndexIsTrack(e.sfn))
+      files.push_back(&e);
+  }
+  if (naturalSort)
+  {
+    std::stable_sort(files.begin(), files.end(),
+                     [](const fatVolume::entry *a, const fatVolume::entry *b)
+                     { return naturalLess(sortName(*a), sortName(*b)); });
+  }
+  if (!files.empty())
+  {
+    if (tracks.size() + files.size() > MUSICINDEX_NONE - 1)
+    {
+      fprintf(stderr, "too many tracks\n");
+      return false;
+    }
+    record.firstTrack = tracks.size();
+    record.trackCnt = files.size();
+    for (const fatVolume::entry *e : files)
+      tracks.push_back(probeTrack(*e));
+    strncpy(record.path, path.c_str(), MUSICINDEX_PATHLEN - 1);
+    folders.push_back(record);
+  }
+
+  for (const fatVolume::entry &e : entries)
+  {
+    if (!e.isDir)
+      continue;
+    // too deep or path too long, not indexed
+    if (depth == MUSICINDEX_DEPTH || path.size() + 1 + strlen(e.sfn) >= MUSICINDEX_PATHLEN)
+      continue;
+    if (!indexFolder(e.cluster, path + "/" + e.sfn, depth + 1))
+      return false;
+  }
+  return true;
+}
+
+static void pad(std::vector<uint8_t> &out, uint8_t value, size_t len)
+{
+  out.insert(out.end(), len, value);
+}
+
+static void alignSector(std::vector<uint8_t> &out)
+{
+  pad(out, 0, (MUSICINDEX_SECTOR - out.size() % MUSICINDEX_SECTOR) % MUSICINDEX_SECTOR);
+}
+
+// file layout of musicIndexWriter::finish()
+static std::vector<uint8_t> buildIndex()
+{
+  std::vector<uint8_t> out;
+  musicIndexHeader header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MUSICINDEX_MAGIC, 4);
+  header.version = MUSICINDEX_VERSION;
+  header.folderCount = folders.size();
+  header.trackCount = tracks.size();
+  header.trackTable = MUSICINDEX_SECTOR;
+
+  pad(out, 0, MUSICINDEX_SECTOR);
+  for (const musicIndexTrack &t : tracks)
+    out.insert(out.end(), (const uint8_t *)&t, (const uint8_t *)(&t + 1));
+  alignSector(out);
+  header.folderTable = out.size();
+  for (const musicIndexFolder &f : folders)
+    out.insert(out.end(), (const uint8_t *)&f, (const uint8_t *)(&f + 1));
+
+  uint32_t slots = MUSICINDEX_SECTOR / sizeof(musicIndexSlot);
+  while (slots < 2UL * folders.size())
+    slots <<= 1;
+  if (slots <= 0x8000)
+  {
+    alignSector(out);
+    header.hashTable = out.size();
+    header.hashSlots = slots;
+    std::vector<musicIndexSlot> table(slots);
+    memset(table.data(), 0xFF, slots * sizeof(musicIndexSlot));
+    for (uint16_t f = 0; f < folders.size(); f++)
+    {
+      if (strlen(folders[f].path) <= MUSICINDEX_TAGOFFSET)
+        continue;
+      uint32_t h = musicIndexHash(folders[f].path + MUSICINDEX_TAGOFFSET);
+      uint16_t i = h & (slots - 1);
+      while (table[i].folder != MUSICINDEX_NONE)
+        i = (i + 1) & (slots - 1);
+      table[i].folder = f;
+      table[i].check = h >> 16;
+    }
+    out.insert(out.end(), (const uint8_t *)table.data(), (const uint8_t *)(table.data() + slots));
+  }
+  memcpy(out.data(), &header, sizeof(header));
+  return out;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: musicIndexTool [-n] [-o index.bin] <card device, image or folder>\n"
+                  "  -n  natural sort order of the tracks by long name\n"
+                  "  -o  output file, default index.bin\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  const char *output = "index.bin";
+  const char *source = NULL;
+  struct timeval start, end;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-n"))
+      naturalSort = true;
+    else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+      output = argv[++i];
+    else if (argv[i][0] != '-' && !source)
+      source = argv[i];
+    else
+      usage();
+  }
+  if (!source)
+    usage();
+
+  gettimeofday(&start, NULL);
+  struct stat st;
+  fromTree = stat(source, &st) == 0 && S_ISDIR(st.st_mode);
+  if (fromTree)
+  {
+    if (!tree.open(source))
+    {
+      fprintf(stderr, "%s: can't read folder\n", source);
+      return 1;
+    }
+  }
+  else if (!volume.open(source))
+  {
+    fprintf(stderr, "%s: no FAT16/FAT32 volume (%s)\n", source, errno ? strerror(errno) : "bad format");
+    return 1;
+  }
+  if (!indexFolder(0, "", 1))
+    return 1;
+
+  std::vector<uint8_t> index = buildIndex();
+  FILE *f = fopen(output, "wb");
+  if (!f || fwrite(index.data(), 1, index.size(), f) != index.size() || fclose(f))
+  {
+    fprintf(stderr, "%s: write failed\n", output);
+    return 1;
+  }
+  gettimeofday(&end, NULL);
+  printf("%zu folders, %zu tracks, %zu bytes in %ld ms\n", folders.size(), tracks.size(),
+         index.size(), (end.tv_sec - start.tv_sec) * 1000L + (end.tv_usec - start.tv_usec) / 1000);
+  return 0;
+}
@@ -0,0 +1,22 @@
+/***************************************************
+Arduino.h for the host build of the firmware's
+library indexer, only what lib/musicIndex uses.
+
+****************************************************/
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+inline uint32_t millis()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000UL + t.tv_nsec / 1000000;
+}
+
+#endif // ARDUINO_H
@@ -0,0 +1,374 @@
+/***************************************************
+SdFat for the host build of the firmware's library
+indexer, see SdFat.h.
+
+****************************************************/
+
+#include "SdFat.h"
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static struct // the mounted card image, what FatVolume holds in SdFat
+{
+  int fd = -1;
+  uint8_t fatType;
+  uint32_t clusterBytes;
+  uint32_t clusterCount;
+  uint64_t fatStart;     // byte offset of the first FAT
+  uint64_t rootStart;    // byte offset of the FAT16 root directory
+  uint32_t rootEntries;
+  uint32_t rootCluster;  // FAT32
+  uint64_t dataStart;    // byte offset of cluster 2
+} vol;
+
+static uint16_t le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t le32(const uint8_t *p) { return le16(p) | ((uint32_t)le16(p + 2) << 16); }
+
+static bool readImage(uint64_t pos, void *buf, size_t len)
+{
+  return pread(vol.fd, buf, len, pos) == (ssize_t)len;
+}
+
+// FatVolume::init(), part 0 is a volume without partition table
+static bool initVolume(uint8_t part)
+{
+  uint8_t block[512];
+  uint32_t volumeStart = 0;
+
+  if (part)
+  {
+    if (!readImage(0, block, sizeof(block)))
+      return false;
+    const uint8_t *p = block + 0x1BE + 16 * (part - 1);
+    if ((p[0] & 0x7F) != 0 || le32(p + 8) == 0)
+      return false;
+    volumeStart = le32(p + 8);
+  }
+  uint64_t start = (uint64_t)volumeStart * 512;
+  if (!readImage(start, block, sizeof(block)))
+    return false;
+  uint8_t spc = block[13];
+  if (le16(block + 11) != 512 || block[16] == 0 || le16(block + 14) == 0 || spc == 0 ||
+      (spc & (spc - 1)))
+  {
+    return false;
+  }
+  uint32_t fatSectors = le16(block + 22) ? le16(block + 22) : le32(block + 36);
+  uint32_t totalSectors = le16(block + 19) ? le16(block + 19) : le32(block + 32);
+  vol.rootEntries = le16(block + 17);
+  vol.clusterBytes = spc * 512;
+  vol.fatStart = start + (uint64_t)le16(block + 14) * 512;
+  vol.rootStart = vol.fatStart + (uint64_t)block[16] * fatSectors * 512;
+  vol.dataStart = vol.rootStart + ((uint64_t)vol.rootEntries * 32 + 511) / 512 * 512;
+  uint64_t dataSectors = (uint64_t)totalSectors - (vol.dataStart - start) / 512;
+  vol.clusterCount = dataSectors / spc;
+  if (vol.clusterCount < 4085)
+    return false; // FAT12 is no card format
+  vol.fatType = (vol.clusterCount < 65525) ? 16 : 32;
+  vol.rootCluster = (vol.fatType == 32) ? le32(block + 44) : 0;
+  return true;
+}
+
+// FatVolume::fatGet(), false at the end of the chain or on a bad entry
+static bool fatGet(uint32_t cluster, uint32_t *next)
+{
+  uint8_t buf[4];
+  if (cluster < 2 || cluster > vol.clusterCount + 1)
+    return false;
+  uint8_t size = vol.fatType / 8;
+  if (!readImage(vol.fatStart + (uint64_t)cluster * size, buf, size))
+    return false;
+  uint32_t n = (vol.fatType == 16) ? le16(buf) : le32(buf) & 0x0FFFFFFF;
+  uint32_t eoc = (vol.fatType == 16) ? 0xFFF8 : 0x0FFFFFF8;
+  if (n < 2 || n >= eoc)
+    return false;
+  *next = n;
+  return true;
+}
+
+FatFile::hostFd::~hostFd()
+{
+  if (fd >= 0)
+    ::close(fd);
+}
+
+void FatFile::close()
+{
+  _type = closed;
+  _fd.reset();
+  _pos = 0;
+  _curCluster = 0;
+}
+
+int FatFile::read(void *buf, size_t n)
+{
+  uint8_t *dst = (uint8_t *)buf;
+  size_t done = 0;
+
+  if (_type == closed)
+    return -1;
+  if (_type == hostFile)
+  {
+    ssize_t r = pread(_fd->fd, buf, n, _pos);
+    if (r < 0)
+      return -1;
+    _pos += r;
+    return r;
+  }
+  if (_type == file && n > _fileSize - _pos)
+    n = _fileSize - _pos;
+  while (done < n)
+  {
+    uint64_t at;
+    size_t part;
+    if (_type == root16)
+    {
+      if (_pos >= vol.rootEntries * 32)
+        break;
+      at = vol.rootStart + _pos;
+      part = vol.rootEntries * 32 - _pos;
+    }
+    else
+    {
+      uint32_t offset = _pos % vol.clusterBytes;
+      if (offset == 0) // into the next cluster
+      {
+        if (_pos == 0)
+        {
+          if (_firstCluster < 2)
+            break; // empty file
+          _curCluster = _firstCluster;
+        }
+        else if (!fatGet(_curCluster, &_curCluster))
+        {
+          break; // end of a directory
+        }
+      }
+      at = vol.dataStart + (uint64_t)(_curCluster - 2) * vol.clusterBytes + offset;
+      part = vol.clusterBytes - offset;
+    }
+    if (part > n - done)
+      part = n - done;
+    if (!readImage(at, dst + done, part))
+      return -1;
+    done += part;
+    _pos += part;
+  }
+  return done;
+}
+
+size_t FatFile::write(const uint8_t *buf, size_t n)
+{
+  if (_type != hostFile)
+    return 0; // the card image is read-only
+  ssize_t r = pwrite(_fd->fd, buf, n, _pos);
+  if (r < 0)
+    return 0;
+  _pos += r;
+  return r;
+}
+
+// FatFile::seekSet(): walks the chain from the first cluster, not behind the end of a file
+bool FatFile::seek(uint32_t pos)
+{
+  if (_type == closed || (_type != subdir && _type != root16 && pos > size()))
+    return false;
+  if ((_type == subdir || _type == file) && pos)
+  {
+    uint32_t cluster = _firstCluster;
+    for (uint32_t n = (pos - 1) / vol.clusterBytes; n; n--)
+    {
+      if (!fatGet(cluster, &cluster))
+        return false;
+    }
+    _curCluster = cluster;
+  }
+  _pos = pos;
+  return true;
+}
+
+uint32_t FatFile::size() const
+{
+  struct stat st;
+  if (_type == hostFile)
+    return fstat(_fd->fd, &st) == 0 ? st.st_size : 0;
+  return _fileSize; // 0 for directories
+}
+
+bool FatFile::sync()
+{
+  return _type == hostFile && fsync(_fd->fd) == 0;
+}
+
+bool FatFile::truncate(uint32_t length)
+{
+  if (_type != hostFile || ftruncate(_fd->fd, length) != 0)
+    return false;
+  if (_pos > length)
+    _pos = length;
+  return true;
+}
+
+// base, '.', extension, lower case where the NT flags say so
+bool FatFile::getSFN(char *name)
+{
+  uint8_t j = 0;
+  uint8_t lcBit = 0x08; // DIR_NT_LC_BASE
+  if (_type == closed || _type == hostFile)
+    return false;
+  if (_type == root16 || (_type == subdir && _firstCluster == vol.rootCluster && !_entry.name[0]))
+  {
+    strcpy(name, "/");
+    return true;
+  }
+  for (uint8_t i = 0; i < 11; i++)
+  {
+    if (_entry.name[i] == ' ')
+      continue;
+    if (i == 8)
+    {
+      lcBit = 0x10; // DIR_NT_LC_EXT
+      name[j++] = '.';
+    }
+    char c = _entry.name[i];
+    if (c >= 'A' && c <= 'Z' && (_entry.reservedNT & lcBit))
+      c += 'a' - 'A';
+    name[j++] = c;
+  }
+  name[j] = '\0';
+  return true;
+}
+
+// FatFile::readDir(): next file or subdirectory entry, 0 at the end
+int8_t FatFile::readDir(dir_t *d)
+{
+  if (!isDirectory() || (_pos & 0x1F))
+    return -1;
+  while (true)
+  {
+    int n = read(d, sizeof(dir_t));
+    if (n != sizeof(dir_t))
+      return n == 0 ? 0 : -1;
+    if (d->name[0] == 0x00)
+      return 0; // free, last entry
+    if (d->name[0] == 0xE5 || d->name[0] == '.')
+      continue; // deleted, . and ..
+    if ((d->attributes & 0x08) == 0)
+      return n; // not a volume label or long name part
+  }
+}
+
+bool FatFile::openRoot()
+{
+  close();
+  memset(&_entry, 0, sizeof(_entry));
+  _type = (vol.fatType == 16) ? root16 : subdir;
+  _firstCluster = vol.rootCluster;
+  _fileSize = 0;
+  return true;
+}
+
+bool FatFile::openEntry(const dir_t *d, uint16_t index)
+{
+  close();
+  _entry = *d;
+  _dirIndex = index;
+  _type = (d->attributes & 0x10) ? subdir : file;
+  _firstCluster = ((uint32_t)d->firstClusterHigh << 16) | d->firstClusterLow;
+  _fileSize = (_type == file) ? d->fileSize : 0;
+  return true;
+}
+
+// FatFile::openNext(): the entry behind the current position of dir
+bool FatFile::openNext(FatFile *dir)
+{
+  dir_t d;
+  if (!dir->isDirectory() || (dir->_pos & 0x1F))
+    return false;
+  while (true)
+  {
+    uint16_t index = dir->_pos / sizeof(dir_t);
+    if (dir->read(&d, sizeof(d)) != sizeof(d) || d.name[0] == 0x00)
+      return false;
+    if (d.name[0] != 0xE5 && d.name[0] != '.' && (d.attributes & 0x08) == 0)
+      return openEntry(&d, index);
+  }
+}
+
+File File::openNextFile()
+{
+  File f;
+  f.openNext(this);
+  return f;
+}
+
+bool SdFat::begin(const char *image, const char *work)
+{
+  _work = work;
+  if (vol.fd >= 0)
+    ::close(vol.fd);
+  vol.fd = ::open(image, O_RDONLY);
+  // like SdFat::begin(): partition 1 first, then a volume without partition table
+  return vol.fd >= 0 && (initVolume(1) || initVolume(0));
+}
+
+// files the indexer wrote are in the work folder, everything else on the card by 8.3 name
+File SdFat::open(const char *path, int flags)
+{
+  File f;
+  struct stat st;
+  if ((flags & O_CREAT) || (stat(workPath(path).c_str(), &st) == 0 && S_ISREG(st.st_mode)))
+  {
+    int fd = ::open(workPath(path).c_str(), flags, 0644);
+    if (fd >= 0)
+    {
+      f._type = FatFile::hostFile;
+      f._fd.reset(new FatFile::hostFd{fd});
+    }
+    return f;
+  }
+
+  f.openRoot();
+  const char *p = path;
+  while (*p)
+  {
+    while (*p == '/')
+      p++;
+    if (!*p)
+      break;
+    const char *end = strchr(p, '/');
+    std::string name(p, end ? end - p : strlen(p));
+    p += name.size();
+
+    File dir = f;
+    File entry;
+    char sfn[13];
+    dir.rewindDirectory();
+    while (true)
+    {
+      if (!entry.openNext(&dir))
+        return File();
+      if (entry.getSFN(sfn) && !strcasecmp(sfn, name.c_str()))
+        break;
+    }
+    f = entry;
+  }
+  return f;
+}
+
+bool SdFat::exists(const char *path)
+{
+  return open(path);
+}
+
+bool SdFat::remove(const char *path)
+{
+  return unlink(workPath(path).c_str()) == 0;
+}
+
+bool SdFat::rename(const char *from, const char *to)
+{
+  return ::rename(workPath(from).c_str(), workPath(to).c_str()) == 0;
+}
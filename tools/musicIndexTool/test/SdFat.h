@@ -0,0 +1,118 @@
+/***************************************************
+SdFat.h for the host build of the firmware's library
+indexer. Reads a FAT16/FAT32 card image the way
+SdFat 1.1 does: directories are files read through
+their cluster chain, openNext() and readDir() skip
+free, deleted, dot, long name and label entries, and
+getSFN() and dirIndex() come from the 8.3 entry.
+
+This is deliberately separate code from the tool's
+fatVolume, the test compares the two readers.
+
+Files the indexer writes (index.tmp and friends) go
+to a work folder on the host, the image stays
+read-only and looks the same to tool and firmware.
+
+Only the SdFat calls lib/musicIndex makes.
+
+****************************************************/
+
+#ifndef SDFAT_H
+#define SDFAT_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+#define O_READ O_RDONLY
+
+struct dir_t // 8.3 directory entry
+{
+  uint8_t  name[11];
+  uint8_t  attributes;
+  uint8_t  reservedNT;
+  uint8_t  creationTimeTenths;
+  uint16_t creationTime;
+  uint16_t creationDate;
+  uint16_t lastAccessDate;
+  uint16_t firstClusterHigh;
+  uint16_t lastWriteTime;
+  uint16_t lastWriteDate;
+  uint16_t firstClusterLow;
+  uint32_t fileSize;
+};
+
+class FatFile
+{
+public:
+  bool isOpen() const { return _type != closed; }
+  bool isDirectory() const { return _type == root16 || _type == subdir; }
+  void close();
+
+  int read(void *buf, size_t n);
+  size_t write(const uint8_t *buf, size_t n);
+  bool seek(uint32_t pos);
+  uint32_t position() const { return _pos; }
+  uint32_t size() const;
+  bool sync();
+  bool truncate(uint32_t length);
+
+  bool getSFN(char *name);
+  uint16_t dirIndex() const { return _dirIndex; }
+  int8_t readDir(dir_t *d);
+  void rewindDirectory() { seek(0); }
+
+protected:
+  friend class SdFat;
+  enum type
+  {
+    closed,
+    hostFile, // written by the indexer, in the work folder
+    root16,   // FAT16 root directory, fixed size region
+    subdir,   // directory in clusters, FAT32 root too
+    file
+  };
+  struct hostFd // shared by copies like the FAT state of SdFat files
+  {
+    int fd;
+    ~hostFd();
+  };
+
+  bool openRoot();
+  bool openNext(FatFile *dir);
+  bool openEntry(const dir_t *d, uint16_t index);
+
+  type _type = closed;
+  uint32_t _firstCluster = 0;
+  uint32_t _curCluster = 0; // cluster holding byte _pos - 1, 0 at the start
+  uint32_t _pos = 0;
+  uint32_t _fileSize = 0;
+  uint16_t _dirIndex = 0;
+  dir_t _entry = dir_t();   // 8.3 entry this file was opened from
+  std::shared_ptr<hostFd> _fd;
+};
+
+class File : public FatFile
+{
+public:
+  operator bool() const { return isOpen(); }
+  File openNextFile();
+};
+
+class SdFat
+{
+public:
+  bool begin(const char *image, const char *work); // card image, folder for the files written
+  File open(const char *path, int flags = O_READ);
+  bool exists(const char *path);
+  bool remove(const char *path);
+  bool rename(const char *from, const char *to);
+
+private:
+  std::string workPath(const char *path) { return _work + path; }
+
+  std::string _work;
+};
+
+#endif // SDFAT_H
@@ -0,0 +1,493 @@
+/***************************************************
+indexTest
+
+Host build of the firmware's musicIndexer, to check
+that musicIndexTool writes the same index the player
+builds itself from the same card.
+
+  indexTest -g16 card.img      write the fixture card
+  indexTest -g32 card.img      as FAT16 or FAT32 image
+  indexTest card.img work/     full index of the card
+                               into work/index.bin
+
+The firmware reads the image through test/SdFat, the
+tool through its fatVolume, two separate readers.
+
+The fixture is written entry by entry the way a FAT
+driver leaves a card: 8.3 names with numeric tails,
+long name entries, lower case flags, deleted entries,
+a volume label, folders spread over several clusters
+and files in scattered clusters. Its CBR, Xing and
+broken MP3 files, other files, empty folders, folders
+deeper than MUSICINDEX_DEPTH and paths longer than
+MUSICINDEX_PATHLEN cover what the indexer skips.
+The FAT16 card has no partition table, the FAT32 card
+one partition.
+
+****************************************************/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <musicIndexer.h>
+
+SdFat SD;
+
+static void put32be(std::vector<uint8_t> &d, size_t at, uint32_t v)
+{
+  d[at] = v >> 24;
+  d[at + 1] = v >> 16;
+  d[at + 2] = v >> 8;
+  d[at + 3] = v;
+}
+
+// MPEG1 layer III, 44.1 kHz joint stereo, frames of bitrate kbit/s behind an optional ID3v2 tag
+static std::vector<uint8_t> mp3(uint16_t bitrate, uint32_t frames, uint32_t id3, bool xing)
+{
+  static const uint16_t rates[] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320};
+  uint8_t index = 0;
+  while (rates[index] != bitrate)
+    index++;
+  uint16_t frameLen = 144000UL * bitrate / 44100;
+
+  std::vector<uint8_t> d(id3);
+  if (id3 >= 10)
+  {
+    uint32_t body = id3 - 10;
+    memcpy(d.data(), "ID3\x03\x00\x00", 6);
+    d[6] = (body >> 21) & 0x7F; // syncsafe size
+    d[7] = (body >> 14) & 0x7F;
+    d[8] = (body >> 7) & 0x7F;
+    d[9] = body & 0x7F;
+  }
+  for (uint32_t i = 0; i < frames; i++)
+  {
+    size_t at = d.size();
+    d.resize(at + frameLen, 0);
+    d[at] = 0xFF;
+    d[at + 1] = 0xFB;
+    d[at + 2] = index << 4;
+    d[at + 3] = 0x40;
+    if (i == 0 && xing) // frames, bytes and a linear table behind the side information
+    {
+      memcpy(&d[at + 36], "Xing", 4);
+      put32be(d, at + 40, 0x07);
+      put32be(d, at + 44, frames);
+      put32be(d, at + 48, frames * frameLen);
+      for (uint8_t p = 0; p < 100; p++)
+        d[at + 52 + p] = p * 256 / 100;
+    }
+  }
+  return d;
+}
+
+static std::vector<uint8_t> text(const char *s)
+{
+  return std::vector<uint8_t>(s, s + strlen(s));
+}
+
+#define FIXTURE_TIME 1262347200 // 2010-01-01 12:00 UTC
+
+// 512 byte clusters, so folders need more than one; FAT16 without partition table, FAT32 in partition 1
+#define IMG16_SECTORS 8192
+#define IMG16_ROOTENTRIES 512
+#define IMG32_SECTORS 70000
+#define IMG32_START 2048
+
+enum fixtureKind
+{
+  fixtureFile,
+  fixtureFolder,
+  fixtureLabel,
+  fixtureDeleted // entries start with 0xE5, the clusters are free again
+};
+
+struct fixtureEntry
+{
+  int8_t parent;   // folder in this table, -1 for the root
+  uint8_t kind;
+  const char *sfn; // 11 byte name as stored
+  uint8_t nt;      // lower case flags, 0x08 base and 0x10 extension
+  const char *lfn; // long name, NULL for none
+};
+
+// in directory order, folders ahead of their content
+static const fixtureEntry fixture[] = {
+    /*  0 */ {-1, fixtureLabel, "PLAYER     ", 0, NULL},
+    /*  1 */ {-1, fixtureFile, "INTRO   MP3", 0, "Intro.mp3"},
+    /*  2 */ {-1, fixtureFile, "README  TXT", 0x18, NULL},
+    /*  3 */ {-1, fixtureDeleted, "OLD     MP3", 0, "Old.mp3"},
+    /*  4 */ {-1, fixtureFolder, "HOERSP~1   ", 0, "Hoerspiele"},
+    /*  5 */ {-1, fixtureFolder, "MUSIK      ", 0, "Musik"},
+    /*  6 */ {-1, fixtureFolder, "TIEF       ", 0x08, NULL},
+    /*  7 */ {-1, fixtureFolder, "EINSEH~1   ", 0, "Ein sehr langer Ordnername"},
+    /*  8 */ {4, fixtureFolder, "DIEDRE~1   ", 0, "Die drei Fragezeichen"},
+    /*  9 */ {4, fixtureFolder, "BENJAMIN   ", 0, "Benjamin"},
+    /* 10 */ {8, fixtureFile, "FOLGE0~1MP3", 0, "Folge 001 - Der Super-Papagei.mp3"},
+    /* 11 */ {8, fixtureDeleted, "FOLGE0~2MP3", 0, "Folge 002 - Der Karpatenhund.mp3"},
+    /* 12 */ {8, fixtureFile, "FOLGE0~3MP3", 0, "Folge 010 - Der Fluch des Rubins.mp3"},
+    /* 13 */ {8, fixtureFile, "COVER   JPG", 0x18, NULL},
+    /* 14 */ {8, fixtureFile, "FOLGE0~2MP3", 0, "Folge 002 - Der Karpatenhund.mp3"}, // copied again
+    // exactly one cluster of entries, no end marker
+    /* 15 */ {9, fixtureFile, "TRACK1~1MP3", 0, "Track 1.mp3"},
+    /* 16 */ {9, fixtureFile, "TRACK1~2MP3", 0, "Track 10.mp3"},
+    /* 17 */ {9, fixtureFile, "TRACK2~1MP3", 0, "Track 2.mp3"},
+    /* 18 */ {9, fixtureFile, "TRACK1~3MP3", 0, "Track 11.mp3"},
+    /* 19 */ {9, fixtureFile, "TRACK3~1MP3", 0, "Track 3.mp3"},
+    /* 20 */ {9, fixtureFile, "TRACK1~4MP3", 0, "Track 12.mp3"},
+    /* 21 */ {9, fixtureFile, "TRACK2~2MP3", 0, "track 20.MP3"},
+    /* 22 */ {5, fixtureFile, "SONG    MP3", 0x18, NULL},
+    /* 23 */ {5, fixtureFile, "LOUD    MP3", 0, NULL},
+    /* 24 */ {5, fixtureFile, "MIXED   MP3", 0, "Mixed.Mp3"},
+    /* 25 */ {5, fixtureFile, "HIDDEN~1MP3", 0, ".hidden.mp3"},
+    /* 26 */ {5, fixtureFile, "NOTESM~1TXT", 0, "notes.mp3.txt"},
+    /* 27 */ {5, fixtureFolder, "ALBUM   MP3", 0, "Album.mp3"},
+    /* 28 */ {5, fixtureFolder, "KAPUTT     ", 0x08, NULL},
+    /* 29 */ {5, fixtureFolder, "LEER       ", 0, "Leer"},
+    /* 30 */ {5, fixtureFolder, "NURBIL~1   ", 0, "Nur Bilder"},
+    /* 31 */ {27, fixtureFile, "TITEL   MP3", 0, "Titel.mp3"},
+    /* 32 */ {28, fixtureFile, "GARBAGE MP3", 0x18, NULL},
+    /* 33 */ {28, fixtureFile, "EMPTY   MP3", 0x18, NULL},
+    /* 34 */ {28, fixtureFile, "TAGONLY MP3", 0x18, NULL},
+    /* 35 */ {30, fixtureFile, "A       JPG", 0x18, NULL},
+    /* 36 */ {30, fixtureFile, "B       PNG", 0x18, NULL},
+    /* 37 */ {6, fixtureFolder, "1          ", 0, NULL},
+    /* 38 */ {37, fixtureFile, "EINS    MP3", 0x18, NULL},
+    /* 39 */ {37, fixtureFolder, "2          ", 0, NULL},
+    /* 40 */ {39, fixtureFolder, "3          ", 0, NULL},
+    /* 41 */ {40, fixtureFolder, "4          ", 0, NULL},
+    /* 42 */ {41, fixtureFolder, "5          ", 0, NULL},
+    /* 43 */ {42, fixtureFolder, "6          ", 0, NULL},
+    /* 44 */ {43, fixtureFile, "SECHS   MP3", 0x18, NULL},
+    /* 45 */ {43, fixtureFolder, "7          ", 0, NULL},
+    /* 46 */ {45, fixtureFile, "SIEBEN  MP3", 0x18, NULL},
+    /* 47 */ {45, fixtureFolder, "8          ", 0, NULL}, // deeper than MUSICINDEX_DEPTH
+    /* 48 */ {47, fixtureFile, "ACHT    MP3", 0x18, NULL},
+    /* 49 */ {7, fixtureFile, "A       MP3", 0x18, NULL},
+    /* 50 */ {7, fixtureFolder, "NOCHEI~1   ", 0, "Noch ein langer Name"},
+    /* 51 */ {50, fixtureFile, "B       MP3", 0x18, NULL},
+    /* 52 */ {50, fixtureFolder, "UNDNOC~1   ", 0, "Und noch einer"},
+    /* 53 */ {52, fixtureFile, "C       MP3", 0x18, NULL},
+    /* 54 */ {52, fixtureFolder, "ZULANG~1   ", 0, "Zu lang"},
+    /* 55 */ {54, fixtureFile, "D       MP3", 0x18, NULL},
+    /* 56 */ {54, fixtureFolder, "VIELZU~1   ", 0, "Viel zu lang"},
+    /* 57 */ {56, fixtureFile, "E       MP3", 0x18, NULL},
+    /* 58 */ {56, fixtureFolder, "ENDE       ", 0, "Ende"}, // path too long
+    /* 59 */ {58, fixtureFile, "F       MP3", 0x18, NULL},
+};
+#define FIXTURE_ENTRIES (sizeof(fixture) / sizeof(fixture[0]))
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+static uint8_t lfnSlots(const char *lfn)
+{
+  return lfn ? (strlen(lfn) + 12) / 13 : 0;
+}
+
+static uint8_t lfnChecksum(const uint8_t *sfn)
+{
+  uint8_t sum = 0;
+  for (uint8_t i = 0; i < 11; i++)
+    sum = ((sum & 1) << 7) + (sum >> 1) + sfn[i];
+  return sum;
+}
+
+// long name entries, last part first, then the 8.3 entry
+static void addEntries(std::vector<uint8_t> &dir, const fixtureEntry &e, uint32_t cluster,
+                       uint32_t size, time_t mtime)
+{
+  static const uint8_t charPos[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+  uint8_t d[32];
+  uint8_t first = (e.kind == fixtureDeleted) ? 0xE5 : 0;
+
+  size_t len = e.lfn ? strlen(e.lfn) : 0;
+  for (uint8_t ord = lfnSlots(e.lfn); ord; ord--)
+  {
+    memset(d, 0, sizeof(d));
+    d[0] = first ? first : ord | ((ord == lfnSlots(e.lfn)) ? 0x40 : 0);
+    d[11] = 0x0F;
+    d[13] = lfnChecksum((const uint8_t *)e.sfn);
+    for (uint8_t i = 0; i < 13; i++)
+    {
+      size_t c = (ord - 1) * 13 + i;
+      put16(d + charPos[i], (c < len) ? (uint8_t)e.lfn[c] : (c == len) ? 0x0000 : 0xFFFF);
+    }
+    dir.insert(dir.end(), d, d + sizeof(d));
+  }
+
+  struct tm t;
+  gmtime_r(&mtime, &t);
+  memset(d, 0, sizeof(d));
+  memcpy(d, e.sfn, 11);
+  if (first)
+    d[0] = first;
+  d[11] = (e.kind == fixtureFolder) ? 0x10 : (e.kind == fixtureLabel) ? 0x08 : 0x20;
+  d[12] = e.nt;
+  d[13] = 37; // creation time, not part of the stamp
+  put16(d + 14, 0x5A5A);
+  put16(d + 16, 0x3C21);
+  put16(d + 18, 0x3C21);
+  put16(d + 20, cluster >> 16);
+  put16(d + 22, (t.tm_hour << 11) | (t.tm_min << 5) | (t.tm_sec / 2));
+  put16(d + 24, ((t.tm_year - 80) << 9) | ((t.tm_mon + 1) << 5) | t.tm_mday);
+  put16(d + 26, cluster);
+  put32(d + 28, size);
+  dir.insert(dir.end(), d, d + sizeof(d));
+}
+
+static void dotEntry(std::vector<uint8_t> &dir, const char *name, uint32_t cluster)
+{
+  uint8_t d[32];
+  memset(d, 0, sizeof(d));
+  memset(d, ' ', 11);
+  memcpy(d, name, strlen(name));
+  d[11] = 0x10;
+  put16(d + 20, cluster >> 16);
+  put16(d + 26, cluster);
+  dir.insert(dir.end(), d, d + sizeof(d));
+}
+
+static std::vector<uint8_t> content(const fixtureEntry &e, uint32_t n)
+{
+  if (!memcmp(e.sfn, "GARBAGE MP3", 11))
+    return text("no audio in here, just some text to skip");
+  if (!memcmp(e.sfn, "TAGONLY MP3", 11))
+    return mp3(128, 0, 1034, false);
+  if (!memcmp(e.sfn, "EMPTY   MP3", 11))
+    return std::vector<uint8_t>();
+  if (!memcmp(e.sfn + 8, "MP3", 3))
+    return mp3((n % 2) ? 128 : 64, 20 + n * 3, (n % 3) ? 0 : 10 + n * 100, n % 4 == 1);
+  return text(e.lfn ? e.lfn : e.sfn);
+}
+
+static bool generate(const char *path, uint8_t fatBits)
+{
+  bool fat32 = (fatBits == 32);
+  uint32_t start = fat32 ? IMG32_START : 0;
+  uint32_t volSectors = (fat32 ? IMG32_SECTORS : IMG16_SECTORS) - start;
+  uint32_t reserved = fat32 ? 32 : 1;
+  uint32_t rootSectors = fat32 ? 0 : IMG16_ROOTENTRIES * 32 / 512;
+  uint32_t fatSectors = (volSectors - reserved - rootSectors + 2) * (fatBits / 8) / 512 + 1;
+  uint32_t clusters = volSectors - reserved - 2 * fatSectors - rootSectors;
+  uint64_t volume = (uint64_t)start * 512;
+  uint64_t dataStart = volume + (uint64_t)(reserved + 2 * fatSectors + rootSectors) * 512;
+  std::vector<uint8_t> img((uint64_t)(start + volSectors) * 512, 0);
+
+  // free clusters in scattered order, so chains have to be followed
+  std::vector<uint32_t> order(clusters);
+  uint32_t seed = 12345;
+  for (uint32_t i = 0; i < clusters; i++)
+    order[i] = i + 2;
+  for (uint32_t i = clusters - 1; i > 0; i--)
+  {
+    seed = seed * 1103515245 + 12345;
+    std::swap(order[i], order[(seed >> 8) % (i + 1)]);
+  }
+  std::vector<uint32_t> fat(clusters + 2, 0);
+  uint32_t eoc = fat32 ? 0x0FFFFFFF : 0xFFFF;
+  uint32_t used = 0;
+  auto alloc = [&](uint32_t bytes) -> uint32_t {
+    uint32_t first = 0, last = 0;
+    for (uint32_t n = (bytes + 511) / 512; n; n--)
+    {
+      uint32_t c = order[used++];
+      if (last)
+        fat[last] = c;
+      else
+        first = c;
+      fat[c] = eoc;
+      last = c;
+    }
+    return first;
+  };
+  auto writeChain = [&](uint32_t cluster, const std::vector<uint8_t> &data) {
+    for (size_t at = 0; at < data.size(); at += 512, cluster = fat[cluster])
+    {
+      memcpy(&img[dataStart + (uint64_t)(cluster - 2) * 512], &data[at],
+             std::min<size_t>(512, data.size() - at));
+    }
+  };
+
+  // folder sizes first, root is folder 0 and fixture[i] folder i + 1
+  std::vector<uint32_t> slots(FIXTURE_ENTRIES + 1, 0);
+  for (uint32_t i = 0; i < FIXTURE_ENTRIES; i++)
+  {
+    slots[fixture[i].parent + 1] += lfnSlots(fixture[i].lfn) + 1;
+    if (fixture[i].kind == fixtureFolder)
+      slots[i + 1] += 2; // . and ..
+  }
+  if (!fat32 && slots[0] > IMG16_ROOTENTRIES)
+    return false;
+
+  std::vector<uint32_t> cluster(FIXTURE_ENTRIES + 1, 0);
+  std::vector<std::vector<uint8_t>> data(FIXTURE_ENTRIES + 1);
+  if (fat32)
+    cluster[0] = alloc(slots[0] * 32);
+  for (uint32_t i = 0, n = 0; i < FIXTURE_ENTRIES; i++)
+  {
+    const fixtureEntry &e = fixture[i];
+    if (e.kind == fixtureFolder)
+    {
+      cluster[i + 1] = alloc(slots[i + 1] * 32);
+      dotEntry(data[i + 1], ".", cluster[i + 1]);
+      dotEntry(data[i + 1], "..", (e.parent < 0) ? 0 : cluster[e.parent + 1]);
+    }
+    else if (e.kind == fixtureFile)
+    {
+      data[i + 1] = content(e, n++);
+      cluster[i + 1] = alloc(data[i + 1].size());
+    }
+    else if (e.kind == fixtureDeleted)
+    {
+      cluster[i + 1] = clusters + 1; // free again
+    }
+    uint32_t size = (e.kind == fixtureFile) ? data[i + 1].size() : (e.kind == fixtureDeleted) ? 12345 : 0;
+    addEntries(data[e.parent + 1], e, cluster[i + 1], size, FIXTURE_TIME + i * 3601);
+  }
+  for (uint32_t i = 1; i <= FIXTURE_ENTRIES; i++)
+  {
+    if (fixture[i - 1].kind == fixtureFile || fixture[i - 1].kind == fixtureFolder)
+      writeChain(cluster[i], data[i]);
+  }
+  if (fat32)
+    writeChain(cluster[0], data[0]);
+  else
+    memcpy(&img[volume + (uint64_t)(reserved + 2 * fatSectors) * 512], data[0].data(), data[0].size());
+
+  // boot sector, FSInfo and backup on FAT32, partition table in front
+  uint8_t *bs = &img[volume];
+  memcpy(bs, "\xEB\x58\x90MSWIN4.1", 11);
+  put16(bs + 11, 512);
+  bs[13] = 1;
+  put16(bs + 14, reserved);
+  bs[16] = 2;
+  put16(bs + 17, fat32 ? 0 : IMG16_ROOTENTRIES);
+  bs[21] = 0xF8;
+  put16(bs + 24, 63);
+  put16(bs + 26, 255);
+  put32(bs + 28, start);
+  if (fat32)
+  {
+    put32(bs + 32, volSectors);
+    put32(bs + 36, fatSectors);
+    put32(bs + 44, cluster[0]);
+    put16(bs + 48, 1);
+    put16(bs + 50, 6);
+    bs[64] = 0x80;
+    bs[66] = 0x29;
+    memcpy(bs + 71, "PLAYER     FAT32   ", 19);
+    uint8_t *info = bs + 512;
+    put32(info, 0x41615252);
+    put32(info + 484, 0x61417272);
+    put32(info + 488, 0xFFFFFFFF);
+    put32(info + 492, 0xFFFFFFFF);
+    put32(info + 508, 0xAA550000);
+    memcpy(bs + 6 * 512, bs, 1024);
+  }
+  else
+  {
+    put16(bs + 19, volSectors);
+    put16(bs + 22, fatSectors);
+    bs[36] = 0x80;
+    bs[38] = 0x29;
+    memcpy(bs + 43, "PLAYER     FAT16   ", 19);
+  }
+  put16(bs + 510, 0xAA55);
+  if (start)
+  {
+    uint8_t *p = &img[0x1BE];
+    p[4] = 0x0C; // FAT32 LBA
+    put32(p + 8, start);
+    put32(p + 12, volSectors);
+    put16(&img[510], 0xAA55);
+  }
+  fat[0] = fat32 ? 0x0FFFFFF8 : 0xFFF8;
+  fat[1] = eoc;
+  for (uint8_t copy = 0; copy < 2; copy++)
+  {
+    uint8_t *f = &img[volume + (uint64_t)(reserved + copy * fatSectors) * 512];
+    for (uint32_t c = 0; c < fat.size(); c++)
+    {
+      if (fat32)
+        put32(f + c * 4, fat[c]);
+      else
+        put16(f + c * 2, fat[c]);
+    }
+  }
+
+  // sparse, only blocks with data
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, img.size()) != 0)
+  {
+    perror(path);
+    return false;
+  }
+  static const uint8_t zero[4096] = {0};
+  for (size_t at = 0; at < img.size(); at += sizeof(zero))
+  {
+    if (memcmp(&img[at], zero, sizeof(zero)) &&
+        pwrite(fd, &img[at], sizeof(zero), at) != (ssize_t)sizeof(zero))
+    {
+      perror(path);
+      close(fd);
+      return false;
+    }
+  }
+  close(fd);
+  printf("%s: FAT%u, %u clusters, %u used\n", path, fatBits, clusters, used);
+  return true;
+}
+
+// full index like the player's startup with all three buttons pressed
+static bool runIndexer(const char *card, const char *work)
+{
+  static musicIndex current;
+  static musicIndexer indexer;
+
+  if (!SD.begin(card, work))
+  {
+    fprintf(stderr, "%s: no FAT volume\n", card);
+    return false;
+  }
+  if (!indexer.begin(&current, true))
+  {
+    fprintf(stderr, "indexer did not start\n");
+    return false;
+  }
+  while (!indexer.step(100))
+  {
+    if (!indexer.busy())
+    {
+      fprintf(stderr, "indexer failed\n");
+      return false;
+    }
+  }
+  indexer.install();
+  if (!current.isOpen())
+  {
+    fprintf(stderr, "new index does not open\n");
+    return false;
+  }
+  printf("firmware: %u folders, %u tracks\n", current.folderCount(), current.trackCount());
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc == 3 && (!strcmp(argv[1], "-g16") || !strcmp(argv[1], "-g32")))
+    return generate(argv[2], atoi(argv[1] + 2)) ? 0 : 1;
+  if (argc != 3 || argv[1][0] == '-')
+  {
+    fprintf(stderr, "usage: indexTest -g16|-g32 <image>\n       indexTest <image> <work folder>\n");
+    return 2;
+  }
+  return runIndexer(argv[1], argv[2]) ? 0 : 1;
+}
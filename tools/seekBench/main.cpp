@@ -0,0 +1,244 @@
+/***************************************************
+seekBench
+
+Seek cost in a fragmented file with and without the
+player's sparse cluster chain cache (ClusterCache).
+
+  seekBench -g frag.img          write a FAT16 image with
+                                 one fully fragmented file
+  seekBench frag.img [NAME.MP3]  benchmark a root file
+
+Counts FAT lookups and FAT sector reads, the latter
+with the single sector cache SdFat has on the AVR.
+Without the cache a seek backwards walks the chain from
+the first cluster, a seek forward from the current one.
+
+****************************************************/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include <AdaMisch_ClusterCache.h>
+#include "fatVolume.h"
+
+#define SEEKS 1000              // random seeks per run
+#define STEP_BYTES (160 * 1024) // 10 s at 128 kbit/s, one fast forward/backward step
+
+// FAT16 image: 128 MB, 2 KB clusters, 64 MB file whose clusters are shuffled
+#define IMG_SECTORS 262144
+#define IMG_SPC 4
+#define IMG_FATSECTORS 256
+#define IMG_ROOTENTRIES 512
+#define FILE_CLUSTERS 32768
+
+struct fatCounter // FAT access as the player does it through SdFat
+{
+  fatVolume *vol;
+  uint32_t lookups;
+  uint32_t sectorReads;
+  uint32_t sector; // FAT sector in the cache
+};
+
+static bool countNext(void *ctx, uint32_t cluster, uint32_t *next)
+{
+  fatCounter *c = (fatCounter *)ctx;
+  uint32_t sector = cluster * 2 / 512; // FAT16 entries
+  if (sector != c->sector)
+  {
+    c->sector = sector;
+    c->sectorReads++;
+  }
+  c->lookups++;
+  *next = c->vol->next(cluster);
+  return *next != 0;
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+static int generate(const char *path)
+{
+  uint8_t sector[512];
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, (off_t)IMG_SECTORS * 512))
+  {
+    perror(path);
+    return 1;
+  }
+
+  memset(sector, 0, sizeof(sector));
+  memcpy(sector, "\xEB\x3C\x90MSDOS5.0", 11);
+  put16(sector + 11, 512);
+  sector[13] = IMG_SPC;
+  put16(sector + 14, 1); // reserved sectors
+  sector[16] = 2;        // FATs
+  put16(sector + 17, IMG_ROOTENTRIES);
+  sector[21] = 0xF8;
+  put16(sector + 22, IMG_FATSECTORS);
+  put32(sector + 32, IMG_SECTORS);
+  sector[510] = 0x55;
+  sector[511] = 0xAA;
+  pwrite(fd, sector, 512, 0);
+
+  // every cluster of the file in random order, no two neighbours adjacent on the card
+  uint32_t clusters = (IMG_SECTORS - 1 - 2 * IMG_FATSECTORS - IMG_ROOTENTRIES * 32 / 512) / IMG_SPC;
+  std::vector<uint16_t> fat(IMG_FATSECTORS * 256, 0);
+  std::vector<uint16_t> order;
+  for (uint32_t c = 2; c < clusters + 2; c++)
+    order.push_back(c);
+  srand(1);
+  for (size_t i = order.size() - 1; i > 0; i--)
+    std::swap(order[i], order[rand() % (i + 1)]);
+  fat[0] = 0xFFF8;
+  fat[1] = 0xFFFF;
+  for (uint32_t i = 0; i < FILE_CLUSTERS; i++)
+    fat[order[i]] = (i + 1 < FILE_CLUSTERS) ? order[i + 1] : 0xFFFF;
+  for (int f = 0; f < 2; f++)
+    pwrite(fd, fat.data(), fat.size() * 2, (off_t)(1 + f * IMG_FATSECTORS) * 512);
+
+  uint8_t entry[32];
+  memset(entry, 0, sizeof(entry));
+  memcpy(entry, "BOOK    MP3", 11);
+  entry[11] = 0x20;
+  put16(entry + 26, order[0]);
+  put32(entry + 28, (uint32_t)FILE_CLUSTERS * IMG_SPC * 512);
+  pwrite(fd, entry, sizeof(entry), (off_t)(1 + 2 * IMG_FATSECTORS) * 512);
+  close(fd);
+  printf("%s: %u clusters of %u bytes, BOOK.MP3 fragmented into %u pieces\n", path, clusters,
+         IMG_SPC * 512, FILE_CLUSTERS);
+  return 0;
+}
+
+struct result
+{
+  uint32_t lookups, first, maxLookups, sectorReads; // maxLookups leaves out the first seek
+  long us;
+};
+
+static void count(result *r, uint32_t lookups, bool first)
+{
+  if (first)
+    r->first = lookups;
+  else
+    r->maxLookups = std::max(r->maxLookups, lookups);
+}
+
+// seek sequence positions as cluster indices, uncached walk like FatFile::seekSet()
+static result runPlain(fatVolume *vol, uint32_t first, const std::vector<uint32_t> &seeks)
+{
+  fatCounter counter = {vol, 0, 0, 0xFFFFFFFF};
+  result r = {0, 0, 0, 0, 0};
+  struct timeval start, end;
+  uint32_t cur = first, curIndex = 0;
+
+  gettimeofday(&start, NULL);
+  for (const uint32_t &n : seeks)
+  {
+    uint32_t before = counter.lookups;
+    if (n < curIndex)
+    {
+      cur = first;
+      curIndex = 0;
+    }
+    while (curIndex < n && countNext(&counter, cur, &cur))
+      curIndex++;
+    count(&r, counter.lookups - before, &n == &seeks[0]);
+  }
+  gettimeofday(&end, NULL);
+  r.lookups = counter.lookups;
+  r.sectorReads = counter.sectorReads;
+  r.us = (end.tv_sec - start.tv_sec) * 1000000L + end.tv_usec - start.tv_usec;
+  return r;
+}
+
+static result runCached(fatVolume *vol, uint32_t first, uint32_t clusters,
+                        const std::vector<uint32_t> &seeks)
+{
+  fatCounter counter = {vol, 0, 0, 0xFFFFFFFF};
+  result r = {0, 0, 0, 0, 0};
+  struct timeval start, end;
+  ClusterCache cache;
+  uint32_t cluster;
+
+  cache.reset(first, clusters);
+  gettimeofday(&start, NULL);
+  for (const uint32_t &n : seeks)
+  {
+    uint32_t before = counter.lookups;
+    cache.locate(n, countNext, &counter, &cluster);
+    count(&r, counter.lookups - before, &n == &seeks[0]);
+  }
+  gettimeofday(&end, NULL);
+  r.lookups = counter.lookups;
+  r.sectorReads = counter.sectorReads;
+  r.us = (end.tv_sec - start.tv_sec) * 1000000L + end.tv_usec - start.tv_usec;
+  return r;
+}
+
+static void print(const char *name, const result &r, size_t seeks)
+{
+  printf("  %-7s lookups first %5u then avg %7.1f max %5u  FAT sector reads/seek %7.1f  host us %ld\n",
+         name, r.first, (double)(r.lookups - r.first) / (seeks - 1), r.maxLookups,
+         (double)r.sectorReads / seeks, r.us);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc == 3 && !strcmp(argv[1], "-g"))
+    return generate(argv[2]);
+  if (argc < 2 || argc > 3 || argv[1][0] == '-')
+  {
+    fprintf(stderr, "usage: seekBench -g <image>\n       seekBench <image> [NAME.MP3]\n");
+    return 2;
+  }
+  const char *name = (argc == 3) ? argv[2] : "BOOK.MP3";
+
+  fatVolume vol;
+  std::vector<fatVolume::entry> root;
+  if (!vol.open(argv[1]) || !vol.listDir(0, root))
+  {
+    fprintf(stderr, "%s: no FAT16/FAT32 volume\n", argv[1]);
+    return 1;
+  }
+  const fatVolume::entry *file = NULL;
+  for (const fatVolume::entry &e : root)
+  {
+    if (!strcasecmp(e.sfn, name))
+      file = &e;
+  }
+  if (!file || file->cluster < 2)
+  {
+    fprintf(stderr, "%s: not found or empty\n", name);
+    return 1;
+  }
+  uint32_t clusters = (file->size + vol.clusterBytes() - 1) / vol.clusterBytes();
+  uint32_t fragments = 1;
+  for (uint32_t c = file->cluster, n; (n = vol.next(c)) != 0; c = n)
+    fragments += (n != c + 1);
+  printf("%s: %u bytes, %u clusters, %u fragments, cache %u entries\n", name, file->size, clusters,
+         fragments, VS1053_CLUSTERCACHE);
+
+  // random seeks, e.g. resume and percent jumps
+  std::vector<uint32_t> seeks;
+  srand(2);
+  for (int i = 0; i < SEEKS; i++)
+    seeks.push_back(rand() % clusters);
+  printf("%d random seeks\n", SEEKS);
+  print("plain", runPlain(&vol, file->cluster, seeks), seeks.size());
+  print("cached", runCached(&vol, file->cluster, clusters, seeks), seeks.size());
+
+  // fast backward from the end of the file
+  seeks.clear();
+  for (int64_t pos = (int64_t)file->size - 1; pos >= 0; pos -= STEP_BYTES)
+    seeks.push_back(pos / vol.clusterBytes());
+  printf("%zu backward steps of %d kB\n", seeks.size(), STEP_BYTES / 1024);
+  print("plain", runPlain(&vol, file->cluster, seeks), seeks.size());
+  print("cached", runCached(&vol, file->cluster, clusters, seeks), seeks.size());
+  return 0;
+}